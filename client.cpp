@@ -262,9 +262,15 @@ void ClientApp::handle_list_rooms() {
         std::string name = r.value("name","");
         std::string vis = r.value("visibility","public");
         std::string status = r.value("status","idle");
+        std::string players;
+        for (auto& p : r.value("playerNames", json::array())) {
+            if (!players.empty()) players += ", ";
+            players += p.get<std::string>();
+        }
         std::cout << "Room " << id << " | " << name
                   << " | " << vis
-                  << " | " << status << "\n";
+                  << " | " << status
+                  << " | " << players << "\n";
     }
     std::cout << "(Note: private rooms require invite+accept.)\n";
 }
@@ -862,10 +868,41 @@ void ClientApp::handle_invite(int roomId) {
         return;
     }
 
-    std::cout << "Enter target userId to invite: ";
+    std::cout << "Enter target userId or name prefix to invite: ";
     std::string s;
     if (!std::getline(std::cin, s) || s.empty()) return;
-    int targetId = std::stoi(s);
+
+    int targetId = 0;
+    if (s.find_first_not_of("0123456789") == std::string::npos) {
+        targetId = std::stoi(s);
+    } else {
+        nlohmann::json findReq = {
+            {"type","FIND_USERS"},
+            {"sessionId",sessionId},
+            {"prefix",s}
+        };
+        nlohmann::json found;
+        if (!send_and_recv(findReq, found)) return;
+        if (found.value("type","") != "USERS_FOUND" || found["users"].empty()) {
+            std::cout << "[Client] No users matching \"" << s << "\".\n";
+            return;
+        }
+
+        auto& users = found["users"];
+        if (users.size() == 1) {
+            targetId = users[0].value("userId", 0);
+        } else {
+            std::cout << "=== Matching users ===\n";
+            for (auto& u : users) {
+                std::cout << "User " << u.value("userId",0) << " | "
+                          << u.value("name","")
+                          << (u.value("online",false) ? " (online)" : "") << "\n";
+            }
+            std::cout << "Enter userId: ";
+            if (!std::getline(std::cin, s) || s.empty()) return;
+            targetId = std::stoi(s);
+        }
+    }
 
     nlohmann::json req = {
         {"type","INVITE"},
@@ -910,6 +947,39 @@ void ClientApp::handle_get_game_start(int roomId) {
 
 
 
+void ClientApp::handle_match_history() {
+    if (!loggedIn) {
+        std::cout << "Please login first.\n";
+        return;
+    }
+    json req = {
+        {"type","MATCH_HISTORY"},
+        {"sessionId",sessionId},
+        {"limit",10}
+    };
+    json resp;
+    if (!send_and_recv(req, resp)) return;
+
+    if (resp.value("type","") != "MATCH_HISTORY") {
+        std::cout << "[Client] MATCH_HISTORY error: "
+                  << resp.dump() << "\n";
+        return;
+    }
+
+    std::cout << "=== Recent Matches ===\n";
+    if (resp.contains("played")) {
+        std::cout << "played " << resp.value("played", 0)
+                  << " | won " << resp.value("won", 0) << "\n";
+    }
+    for (auto& m : resp["matches"]) {
+        std::cout << (m.value("win", false) ? "WIN " : "LOSS")
+                  << " vs user " << m.value("opponentId", -1)
+                  << " | lines=" << m.value("lines", 0)
+                  << " score=" << m.value("score", 0) << "\n";
+    }
+    if (resp["matches"].empty()) std::cout << "(no matches yet)\n";
+}
+
 // ======================= MAIN MENU =======================
 
 void ClientApp::main_menu() {
@@ -923,6 +993,7 @@ void ClientApp::main_menu() {
         std::cout << "6) Join Public Room\n";
         std::cout << "7) List Invites\n";
         std::cout << "8) Accept Invite\n";
+        std::cout << "9) Match History\n";
         std::cout << "q) Quit\n";
         std::cout << "> ";
 
@@ -937,6 +1008,7 @@ void ClientApp::main_menu() {
         else if (choice == "6") handle_join_room();
         else if (choice == "7") handle_list_invites();
         else if (choice == "8") handle_accept_invite();
+        else if (choice == "9") handle_match_history();
         else if (choice == "q") break;
     }
 }
@@ -34,6 +34,7 @@ private:
     void handle_join_room();       
     void handle_list_invites();    
     void handle_accept_invite();   
+    void handle_match_history();
     
     void handle_list_users(); 
     void handle_invite(int roomId);
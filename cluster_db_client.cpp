@@ -0,0 +1,449 @@
+#include "cluster_db_client.hpp"
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using nlohmann::json;
+
+// Documents per page when copying a collection during rebalance; keeps
+// each reply well under the protocol's frame limit.
+static constexpr int kMovePage = 256;
+
+// Membership lives on the sequencer as document 1 of this collection:
+// {"id":1, "version":N, "nodes":["host:port", ...]}.
+static const char* const kMembershipColl = "_cluster";
+// How long add_node keeps the old copies after publishing a membership:
+// long enough for every client to have checked for it.
+static constexpr auto kSwitchGrace = 3 * ClusterDbClient::kMembershipCheck;
+
+ClusterDbClient::ClusterDbClient(const std::vector<std::string>& names, size_t conns)
+    : connsPerNode(conns ? conns : 1) {
+    if (names.empty()) throw std::invalid_argument("cluster needs at least one node");
+    for (const auto& name : names) {
+        nodes.push_back(connect(name));
+        ring.add(nodes.size() - 1, name);
+    }
+    load_membership(*nodes[0].pool);
+    nextSync = (std::chrono::steady_clock::now() + kMembershipCheck).time_since_epoch().count();
+}
+
+// Adopts the membership stored on seq if it is newer than ours, reusing
+// the pools of nodes we already know. Returns whether the ring changed.
+bool ClusterDbClient::load_membership(DbClientPool& seq) {
+    json r = seq.read(kMembershipColl, {{"id", 1}});
+    if (r.value("status", "") != "ok" || !r["data"].is_object()) return false;
+    const json& m = r["data"];
+    if (!m.contains("version") || !m["version"].is_number_integer()
+        || !m.contains("nodes") || !m["nodes"].is_array() || m["nodes"].empty())
+        return false;
+    uint64_t version = m["version"].get<uint64_t>();
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        if (version <= membershipVersion) return false;
+    }
+
+    std::vector<Node> known;
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        known = nodes;
+    }
+    std::vector<Node> fresh;
+    HashRing freshRing;
+    for (const auto& n : m["nodes"]) {
+        if (!n.is_string()) return false;
+        std::string name = n.get<std::string>();
+        auto it = std::find_if(known.begin(), known.end(), [&](const Node& k) { return k.name == name; });
+        fresh.push_back(it != known.end() ? *it : connect(name));
+        freshRing.add(fresh.size() - 1, name);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (version <= membershipVersion) return false;     // a concurrent load won
+    nodes = std::move(fresh);
+    ring = std::move(freshRing);
+    membershipVersion = version;
+    return true;
+}
+
+// Compare-and-set on the stored version, so two rebalances cannot both
+// publish on top of the same membership.
+bool ClusterDbClient::store_membership(DbClientPool& seq, uint64_t version,
+                                       const std::vector<std::string>& names) {
+    json doc = {{"version", version}, {"nodes", names}};
+    if (version == 1) {
+        doc["id"] = 1;
+        return seq.create(kMembershipColl, doc).value("status", "") == "ok";
+    }
+    json r = seq.update(kMembershipColl, {{"id", 1}, {"version", version - 1}}, doc);
+    return r.value("status", "") == "ok" && r.value("updated", 0) == 1;
+}
+
+// Called before routing; checks the sequencer at most once per
+// kMembershipCheck, and never holds up a caller while another checks.
+void ClusterDbClient::sync_membership() {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    if (now < nextSync.load(std::memory_order_relaxed)) return;
+    std::unique_lock<std::mutex> lock(syncMtx, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    nextSync = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(kMembershipCheck).count();
+
+    std::shared_ptr<DbClientPool> seq;
+    {
+        std::shared_lock<std::shared_mutex> rl(mtx);
+        seq = nodes[0].pool;
+    }
+    try {
+        load_membership(*seq);
+    } catch (const std::exception&) {}  // unreachable sequencer: keep the ring, retry later
+}
+
+ClusterDbClient::Node ClusterDbClient::connect(const std::string& name) {
+    size_t colon = name.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == name.size())
+        throw std::invalid_argument("node must be host:port: " + name);
+    std::string host = name.substr(0, colon);
+    uint16_t port = static_cast<uint16_t>(std::stoi(name.substr(colon + 1)));
+    return {name, std::make_shared<DbClientPool>(host, port, connsPerNode)};
+}
+
+std::string ClusterDbClient::doc_key(const std::string& coll, int id) {
+    return coll + "/" + std::to_string(id);
+}
+
+bool ClusterDbClient::id_of(const json& filter, int& id) {
+    if (!filter.is_object() || filter.size() != 1) return false;
+    auto it = filter.find("id");
+    if (it == filter.end() || !it->is_number_integer()) return false;
+    id = it->get<int>();
+    return true;
+}
+
+std::shared_ptr<DbClientPool> ClusterDbClient::owner(const std::string& coll, int id) {
+    sync_membership();
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return nodes[ring.owner(doc_key(coll, id))].pool;
+}
+
+std::shared_ptr<DbClientPool> ClusterDbClient::sequencer() {
+    sync_membership();
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return nodes[0].pool;
+}
+
+std::vector<std::shared_ptr<DbClientPool>> ClusterDbClient::all_nodes() {
+    sync_membership();
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    std::vector<std::shared_ptr<DbClientPool>> pools;
+    for (auto& n : nodes) pools.push_back(n.pool);
+    return pools;
+}
+
+std::vector<std::string> ClusterDbClient::node_names() {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    std::vector<std::string> names;
+    for (auto& n : nodes) names.push_back(n.name);
+    return names;
+}
+
+std::vector<json> ClusterDbClient::fan_out(const Op& op) {
+    std::vector<std::future<json>> pending;
+    for (auto& pool : all_nodes()) pending.push_back(pool->submit(op));
+
+    std::vector<json> results;
+    for (auto& f : pending) {
+        try {
+            results.push_back(f.get());
+        } catch (const std::exception& e) {
+            results.push_back({{"status","error"},{"message",e.what()}});
+        }
+    }
+    return results;
+}
+
+const json* ClusterDbClient::first_error(const std::vector<json>& results) {
+    for (const auto& r : results) {
+        if (r.value("status", "") != "ok") return &r;
+    }
+    return nullptr;
+}
+
+json ClusterDbClient::sum_counts(const std::vector<json>& results, const std::string& field) {
+    if (const json* err = first_error(results)) return *err;
+    int total = 0;
+    for (const auto& r : results) total += r.value(field, 0);
+    return {{"status","ok"},{field,total}};
+}
+
+// ---- routed calls ----
+
+json ClusterDbClient::create(const std::string& coll, const json& data) {
+    if (!data.is_object())
+        return {{"status","error"},{"message","data must be object"}};
+
+    json doc = data;
+    int id;
+    if (doc.contains("id") && doc["id"].is_number_integer()) {
+        id = doc["id"].get<int>();
+    } else {
+        json r = reserve_ids(coll, 1);
+        if (r.value("status", "") != "ok") return r;
+        id = r["first"].get<int>();
+        doc["id"] = id;
+    }
+    return owner(coll, id)->create(coll, doc);
+}
+
+json ClusterDbClient::read(const std::string& coll, const json& filter) {
+    int id;
+    if (id_of(filter, id)) return owner(coll, id)->read(coll, filter);
+
+    std::vector<json> results = fan_out([=](DbBackend& b) { return b.read(coll, filter); });
+    if (const json* err = first_error(results)) return *err;
+    for (auto& r : results) {
+        if (!r["data"].is_null()) return r;
+    }
+    return {{"status","ok"},{"data",nullptr}};
+}
+
+json ClusterDbClient::mget(const std::string& coll, const json& ids) {
+    if (!ids.is_array())
+        return {{"status","error"},{"message","data must be an array of ids"}};
+
+    // One mget per owning node; replies are scattered back by position.
+    struct Group {
+        json ids = json::array();
+        std::vector<size_t> positions;
+    };
+    std::unordered_map<DbClientPool*, std::pair<std::shared_ptr<DbClientPool>, Group>> groups;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (!ids[i].is_number_integer())
+            return {{"status","error"},{"message","data must be an array of ids"}};
+        auto pool = owner(coll, ids[i].get<int>());
+        auto& g = groups[pool.get()];
+        g.first = pool;
+        g.second.ids.push_back(ids[i]);
+        g.second.positions.push_back(i);
+    }
+
+    std::vector<std::pair<std::future<json>, const Group*>> pending;
+    for (auto& [key, entry] : groups) {
+        json sub = entry.second.ids;
+        pending.emplace_back(entry.first->submit([=](DbBackend& b) { return b.mget(coll, sub); }),
+                             &entry.second);
+    }
+
+    json items(json::value_t::array);
+    for (size_t i = 0; i < ids.size(); ++i) items.push_back(nullptr);
+    json error;
+    for (auto& [f, g] : pending) {
+        json r;
+        try {
+            r = f.get();
+        } catch (const std::exception& e) {
+            r = {{"status","error"},{"message",e.what()}};
+        }
+        if (r.value("status", "") != "ok") {
+            if (error.is_null()) error = r;
+            continue;
+        }
+        for (size_t k = 0; k < g->positions.size() && k < r["items"].size(); ++k) {
+            items[g->positions[k]] = r["items"][k];
+        }
+    }
+    if (!error.is_null()) return error;
+    return {{"status","ok"},{"items",items}};
+}
+
+json ClusterDbClient::query(const std::string& coll, const json& filter, const json& options) {
+    std::vector<json> results = fan_out([=](DbBackend& b) { return b.query(coll, filter, options); });
+    if (const json* err = first_error(results)) return *err;
+
+    size_t limit = 0;
+    if (options.contains("limit") && options["limit"].is_number_integer()
+        && options["limit"].get<int64_t>() >= 0)
+        limit = options["limit"].get<size_t>();
+
+    json items = json::array();
+    for (auto& r : results) {
+        for (auto& doc : r["items"]) {
+            if (limit && items.size() >= limit) break;
+            items.push_back(std::move(doc));
+        }
+    }
+    return {{"status","ok"},{"items",items}};
+}
+
+json ClusterDbClient::update(const std::string& coll, const json& filter, const json& data) {
+    int id;
+    if (id_of(filter, id)) return owner(coll, id)->update(coll, filter, data);
+    return sum_counts(fan_out([=](DbBackend& b) { return b.update(coll, filter, data); }), "updated");
+}
+
+json ClusterDbClient::del(const std::string& coll, const json& filter) {
+    int id;
+    if (id_of(filter, id)) return owner(coll, id)->del(coll, filter);
+    return sum_counts(fan_out([=](DbBackend& b) { return b.del(coll, filter); }), "deleted");
+}
+
+json ClusterDbClient::reset(const std::string& coll, const json& filter) {
+    std::vector<json> results = fan_out([=](DbBackend& b) { return b.reset(coll, filter); });
+    if (const json* err = first_error(results)) return *err;
+    return results[0];
+}
+
+json ClusterDbClient::create_index(const std::string& coll, const json& spec) {
+    std::vector<json> results = fan_out([=](DbBackend& b) { return b.create_index(coll, spec); });
+    if (const json* err = first_error(results)) return *err;
+    bool created = false;
+    for (auto& r : results) created = created || r.value("created", false);
+    return {{"status","ok"},{"created",created}};
+}
+
+json ClusterDbClient::create_time_series(const std::string& coll, const json& spec) {
+    return sequencer()->create_time_series(coll, spec);
+}
+
+// A view aggregates the node it lives on, which sees every record of a
+// time series but only its own shard of a collection.
+json ClusterDbClient::create_view(const std::string& name, const json& spec) {
+    return sequencer()->create_view(name, spec);
+}
+
+// A procedure is atomic on one node only, and sees that node's shard.
+json ClusterDbClient::call(const std::string& procedure, const json& args) {
+    return sequencer()->call(procedure, args);
+}
+
+json ClusterDbClient::append(const std::string& coll, const json& records) {
+    return sequencer()->append(coll, records);
+}
+
+json ClusterDbClient::reserve_ids(const std::string& coll, int count) {
+    return sequencer()->reserve_ids(coll, count);
+}
+
+// ---- cluster management ----
+
+json ClusterDbClient::stats() {
+    sync_membership();
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    json out = json::object();
+    for (auto& n : nodes) {
+        auto lease = n.pool->checkout();
+        out[n.name] = lease->send_async({{"action","stats"}}).get();
+    }
+    return out;
+}
+
+// Copies the documents of one collection on node `from` that the new ring
+// assigns to the new node, page by page over the id space. Returns the
+// ids copied, to be deleted from `from` once the ring has switched.
+std::vector<int> ClusterDbClient::copy_moving_docs(const Node& from, const std::string& coll, int nextId,
+                                                   const HashRing& newRing, size_t newNode,
+                                                   DbClientPool& target) {
+    std::vector<int> moved;
+    auto copy_page = [&](const json& filter) {
+        json r = from.pool->query(coll, filter);
+        if (r.value("status", "") != "ok")
+            throw std::runtime_error("query " + coll + " on " + from.name + ": " + r.dump());
+        for (auto& doc : r["items"]) {
+            int id = doc["id"].get<int>();
+            if (newRing.owner(doc_key(coll, id)) != newNode) continue;
+            json c = target.create(coll, doc);
+            if (c.value("status", "") != "ok" && c.value("message", "") != "id already exists")
+                throw std::runtime_error("copy " + coll + "/" + std::to_string(id) + ": " + c.dump());
+            moved.push_back(id);
+        }
+    };
+
+    copy_page({{"id", {{"$lt", 1}}}});     // explicit ids below the sequence
+    for (int lo = 1; lo < nextId; lo += kMovePage) {
+        copy_page({{"id", {{"$gte", lo}, {"$lt", lo + kMovePage}}}});
+    }
+    return moved;
+}
+
+json ClusterDbClient::add_node(const std::string& name) {
+    std::lock_guard<std::mutex> rebalanceLock(rebalanceMtx);
+
+    load_membership(*sequencer());     // start from the latest
+    std::vector<Node> current;
+    HashRing newRing;
+    uint64_t version;
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        current = nodes;
+        newRing = ring;
+        version = membershipVersion;
+    }
+    for (auto& n : current) {
+        if (n.name == name)
+            return {{"status","error"},{"message","node already in cluster"}};
+    }
+
+    Node fresh = connect(name);
+    size_t newNode = current.size();
+    newRing.add(newNode, name);
+
+    // Copy phase: the ring is unchanged, so every request still finds its
+    // document on the old owner.
+    struct Moved {
+        size_t node;
+        std::string coll;
+        std::vector<int> ids;
+    };
+    std::vector<Moved> movedDocs;
+    size_t movedCount = 0;
+    for (size_t i = 0; i < current.size(); ++i) {
+        json st;
+        {
+            auto lease = current[i].pool->checkout();
+            st = lease->send_async({{"action","stats"}}).get();
+        }
+        if (st.value("status", "") != "ok")
+            return {{"status","error"},{"message","stats failed on " + current[i].name}};
+
+        for (auto it = st["collections"].begin(); it != st["collections"].end(); ++it) {
+            const json& info = it.value();
+            std::string type = info.value("type", "");
+            if (type == "timeseries" || type == "view" || it.key() == kMembershipColl)
+                continue;   // sequencer only
+            for (auto& spec : info.value("indexes", json::array())) {
+                fresh.pool->create_index(it.key(), spec);
+            }
+            std::vector<int> ids = copy_moving_docs(current[i], it.key(), info.value("nextId", 1),
+                                                    newRing, newNode, *fresh.pool);
+            movedCount += ids.size();
+            if (!ids.empty()) movedDocs.push_back({i, it.key(), std::move(ids)});
+        }
+    }
+
+    // Clients switch when they next check the membership; until then they
+    // still find documents on the old owners, so the copies stay a while.
+    std::vector<std::string> names;
+    for (auto& n : current) names.push_back(n.name);
+    names.push_back(name);
+    if (!store_membership(*current[0].pool, version + 1, names))
+        return {{"status","error"},{"message","cluster membership changed during the rebalance"}};
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        nodes.push_back(fresh);
+        ring = newRing;
+        membershipVersion = version + 1;
+    }
+    std::this_thread::sleep_for(kSwitchGrace);
+
+    // Old copies are now unreachable through the ring; drop them in batches.
+    for (auto& m : movedDocs) {
+        for (size_t k = 0; k < m.ids.size(); k += kMovePage) {
+            size_t end = std::min(m.ids.size(), k + kMovePage);
+            json batch(std::vector<int>(m.ids.begin() + k, m.ids.begin() + end));
+            current[m.node].pool->del(m.coll, {{"id", {{"$in", batch}}}});
+        }
+    }
+
+    return {{"status","ok"},{"moved",movedCount},{"nodes",current.size() + 1}};
+}
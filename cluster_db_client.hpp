@@ -0,0 +1,105 @@
+#ifndef CLUSTER_DB_CLIENT_HPP
+#define CLUSTER_DB_CLIENT_HPP
+
+#include "db_client.hpp"
+#include "db_client_pool.hpp"
+#include "hash_ring.hpp"
+#include "json.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Spreads documents over several db_server processes. Each document is
+// owned by the node that "<collection>/<id>" hashes to on a consistent-hash
+// ring, so requests by id go to exactly one node, while filters, queries,
+// and index or reset requests fan out to every node and are merged here.
+//
+// The first node is also the sequencer: it hands out ids for documents
+// created without one (via reserveIds) and holds all time series, which
+// are not sharded.
+//
+// The sequencer also stores the cluster membership, a versioned node list
+// in the _cluster collection, written by add_node. Every client adopts it
+// when constructed and looks for a newer version at most once per
+// kMembershipCheck before routing, so running clients follow a rebalance
+// without being restarted.
+class ClusterDbClient : public DbBackend {
+public:
+    static constexpr std::chrono::milliseconds kMembershipCheck{1000};
+
+    // nodes are "host:port", the sequencer first; connsPerNode pooled
+    // connections to each. If the sequencer has a membership stored, its
+    // node list replaces the rest of `nodes`.
+    explicit ClusterDbClient(const std::vector<std::string>& nodes, size_t connsPerNode = 2);
+
+    ClusterDbClient(const ClusterDbClient&) = delete;
+    ClusterDbClient& operator=(const ClusterDbClient&) = delete;
+
+    nlohmann::json create(const std::string& coll, const nlohmann::json& data) override;
+    nlohmann::json read(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json mget(const std::string& coll, const nlohmann::json& ids) override;
+    nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                         const nlohmann::json& options = nlohmann::json::object()) override;
+    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    nlohmann::json del(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json reset(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_view(const std::string& name, const nlohmann::json& spec) override;
+    nlohmann::json call(const std::string& procedure, const nlohmann::json& args) override;
+    nlohmann::json append(const std::string& coll, const nlohmann::json& records) override;
+    nlohmann::json reserve_ids(const std::string& coll, int count) override;
+
+    // Adds a node and moves to it every document it now owns: copy to the
+    // new node, publish the new membership and switch the ring, wait until
+    // every client has had time to follow (kSwitchGrace), then delete the
+    // old copies. Writes should be quiesced meanwhile. Returns
+    // {"status","moved","nodes"}.
+    nlohmann::json add_node(const std::string& node);
+
+    std::vector<std::string> node_names();
+    // Each node's own stats response, keyed by node name.
+    nlohmann::json stats();
+
+private:
+    struct Node {
+        std::string name;
+        std::shared_ptr<DbClientPool> pool;
+    };
+
+    size_t connsPerNode;
+    std::mutex rebalanceMtx;    // one add_node at a time
+    std::shared_mutex mtx;      // guards nodes and ring; held exclusive only to swap them
+    std::vector<Node> nodes;
+    HashRing ring;
+    uint64_t membershipVersion = 0;     // of nodes; 0 until one is stored
+
+    std::mutex syncMtx;                 // one membership check at a time
+    std::atomic<int64_t> nextSync{0};   // steady_clock ticks
+
+    void sync_membership();
+    bool load_membership(DbClientPool& seq);
+    bool store_membership(DbClientPool& seq, uint64_t version, const std::vector<std::string>& names);
+
+    Node connect(const std::string& name);
+    static std::string doc_key(const std::string& coll, int id);
+    static bool id_of(const nlohmann::json& filter, int& id);
+
+    std::shared_ptr<DbClientPool> owner(const std::string& coll, int id);
+    std::shared_ptr<DbClientPool> sequencer();
+    std::vector<std::shared_ptr<DbClientPool>> all_nodes();
+
+    // Runs op on every node concurrently; results are in node order.
+    std::vector<nlohmann::json> fan_out(const Op& op);
+    static const nlohmann::json* first_error(const std::vector<nlohmann::json>& results);
+    static nlohmann::json sum_counts(const std::vector<nlohmann::json>& results, const std::string& field);
+
+    std::vector<int> copy_moving_docs(const Node& from, const std::string& coll, int nextId,
+                                      const HashRing& newRing, size_t newNode, DbClientPool& target);
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "concurrent_doc_map.hpp"
+#include <cstdio>
+#include <mutex>
+
+// ---- StoredDoc ----
+
+const std::string& StoredDoc::bytes() const {
+    std::call_once(serializeOnce, [this] { serialized = value.dump(); });
+    return serialized;
+}
+
+const std::string& StoredDoc::etag() const {
+    std::call_once(etagOnce, [this] {
+        uint64_t h = 1469598103934665603ULL;    // FNV-1a
+        for (unsigned char ch : bytes()) {
+            h ^= ch;
+            h *= 1099511628211ULL;
+        }
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+        tag = buf;
+    });
+    return tag;
+}
+
+// ---- ConcurrentDocMap ----
+
+static size_t round_up_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+ConcurrentDocMap::ConcurrentDocMap(size_t shardCount) {
+    size_t n = round_up_pow2(shardCount ? shardCount : 1);
+    shards.reset(new Shard[n]);
+    mask = n - 1;
+}
+
+ConcurrentDocMap::ConcurrentDocMap(ConcurrentDocMap&& other) noexcept
+    : shards(std::move(other.shards)), mask(other.mask), count(other.count.load()) {
+    other.shards.reset(new Shard[1]);
+    other.mask = 0;
+    other.count = 0;
+}
+
+ConcurrentDocMap& ConcurrentDocMap::operator=(ConcurrentDocMap&& other) noexcept {
+    if (this == &other) return *this;
+    shards = std::move(other.shards);
+    mask = other.mask;
+    count = other.count.load();
+    other.shards.reset(new Shard[1]);
+    other.mask = 0;
+    other.count = 0;
+    return *this;
+}
+
+ConcurrentDocMap::Shard& ConcurrentDocMap::shard_for(int id) const {
+    // Fibonacci hashing spreads sequential ids across shards.
+    uint64_t h = (uint64_t)(uint32_t)id * 0x9E3779B97F4A7C15ull;
+    return shards[(h >> 32) & mask];
+}
+
+DocPtr ConcurrentDocMap::get(int id) const {
+    Shard& s = shard_for(id);
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.docs.find(id);
+    return it == s.docs.end() ? nullptr : it->second;
+}
+
+bool ConcurrentDocMap::insert(int id, DocPtr doc) {
+    Shard& s = shard_for(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    if (!s.docs.emplace(id, std::move(doc)).second) return false;
+    count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+DocPtr ConcurrentDocMap::replace(int id, DocPtr doc) {
+    Shard& s = shard_for(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    DocPtr& slot = s.docs[id];
+    if (!slot) count.fetch_add(1, std::memory_order_relaxed);
+    slot.swap(doc);
+    return doc;
+}
+
+DocPtr ConcurrentDocMap::erase(int id) {
+    Shard& s = shard_for(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.docs.find(id);
+    if (it == s.docs.end()) return nullptr;
+    DocPtr doc = std::move(it->second);
+    s.docs.erase(it);
+    count.fetch_sub(1, std::memory_order_relaxed);
+    return doc;
+}
+
+void ConcurrentDocMap::clear() {
+    for (size_t i = 0; i <= mask; ++i) {
+        std::unique_lock<std::shared_mutex> lock(shards[i].mtx);
+        count.fetch_sub(shards[i].docs.size(), std::memory_order_relaxed);
+        shards[i].docs.clear();
+    }
+}
+
+void ConcurrentDocMap::for_each(const std::function<bool(int, const DocPtr&)>& fn) const {
+    for (size_t i = 0; i <= mask; ++i) {
+        std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+        for (auto& [id, doc] : shards[i].docs) {
+            if (!fn(id, doc)) return;
+        }
+    }
+}
+
+void ConcurrentDocMap::for_each_in_shard(size_t shard,
+                                         const std::function<bool(int, const DocPtr&)>& fn) const {
+    std::shared_lock<std::shared_mutex> lock(shards[shard].mtx);
+    for (auto& [id, doc] : shards[shard].docs) {
+        if (!fn(id, doc)) return;
+    }
+}
+
+// ---- IdAllocator ----
+
+void IdAllocator::observe(int id) {
+    int cur = next.load();
+    while (id >= cur && !next.compare_exchange_weak(cur, id + 1)) {}
+}
@@ -0,0 +1,98 @@
+#ifndef CONCURRENT_DOC_MAP_HPP
+#define CONCURRENT_DOC_MAP_HPP
+
+#include "json.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// A stored document. Documents are immutable once stored: an update swaps
+// in a new version, so a reader that got a DocPtr keeps a consistent
+// document without any lock, and the serialized form never goes stale.
+class StoredDoc {
+public:
+    explicit StoredDoc(nlohmann::json v) : value(std::move(v)) {}
+
+    const nlohmann::json value;
+
+    // value.dump(), computed on first use and then reused by every
+    // response that includes this version of the document.
+    const std::string& bytes() const;
+
+    // Hash of bytes() as 16 hex digits; identifies this content across
+    // versions and restarts (see ifNoneMatch in Database).
+    const std::string& etag() const;
+
+private:
+    mutable std::once_flag serializeOnce;
+    mutable std::string serialized;
+    mutable std::once_flag etagOnce;
+    mutable std::string tag;
+};
+
+using DocPtr = std::shared_ptr<const StoredDoc>;
+
+// Primary-key map of a collection, split into independently locked shards.
+// Lookups take only their shard's shared lock, so they never wait on each
+// other and only briefly on a writer to the same shard.
+class ConcurrentDocMap {
+public:
+    explicit ConcurrentDocMap(size_t shardCount = 64);
+    ConcurrentDocMap(ConcurrentDocMap&& other) noexcept;
+    ConcurrentDocMap& operator=(ConcurrentDocMap&& other) noexcept;
+
+    DocPtr get(int id) const;
+    bool contains(int id) const { return get(id) != nullptr; }
+    bool insert(int id, DocPtr doc);    // false if id is already present
+    DocPtr replace(int id, DocPtr doc); // returns the previous version
+    DocPtr erase(int id);               // returns the removed document
+    void clear();
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+    // Visits documents one shard at a time under that shard's shared lock
+    // until fn returns false; fn must not write to the map.
+    void for_each(const std::function<bool(int, const DocPtr&)>& fn) const;
+
+    // Shards are disjoint, so parallel scans can split work along them.
+    size_t shard_count() const { return mask + 1; }
+    void for_each_in_shard(size_t shard, const std::function<bool(int, const DocPtr&)>& fn) const;
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<int, DocPtr> docs;
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    size_t mask;
+    std::atomic<size_t> count{0};
+
+    Shard& shard_for(int id) const;
+};
+
+// Hands out primary keys without a lock; explicit ids pushed through
+// observe() keep later allocations above them.
+class IdAllocator {
+public:
+    explicit IdAllocator(int next = 1) : next(next) {}
+    IdAllocator(IdAllocator&& other) noexcept : next(other.peek()) {}
+    IdAllocator& operator=(IdAllocator&& other) noexcept {
+        next.store(other.peek());
+        return *this;
+    }
+
+    int allocate() { return next.fetch_add(1); }
+    int reserve(int n) { return next.fetch_add(n); }   // first of n consecutive ids
+    void observe(int id);
+    int peek() const { return next.load(); }
+
+private:
+    std::atomic<int> next;
+};
+
+#endif
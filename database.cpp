@@ -0,0 +1,1919 @@
+#include "database.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+
+using nlohmann::json;
+namespace fs = std::filesystem;
+
+static bool valid_collection_name(const std::string& name) {
+    if (name.empty() || name[0] == '.') return false;
+    for (char ch : name) {
+        if (!std::isalnum((unsigned char)ch) && ch != '_' && ch != '-' && ch != '.')
+            return false;
+    }
+    return true;
+}
+
+// Rough heap footprint of a json value, used for memory budgeting only.
+static size_t approx_bytes(const json& j) {
+    size_t n = sizeof(json);
+    switch (j.type()) {
+    case json::value_t::object:
+        for (auto it = j.begin(); it != j.end(); ++it)
+            n += 64 + it.key().size() + approx_bytes(it.value());
+        break;
+    case json::value_t::array:
+        for (const auto& v : j) n += approx_bytes(v);
+        break;
+    case json::value_t::string:
+        n += 32 + j.get_ref<const std::string&>().size();
+        break;
+    default:
+        break;
+    }
+    return n;
+}
+
+static void add_indexes(InMemoryCollection& c, const json& indexSpecs) {
+    for (const auto& spec : indexSpecs) {
+        try {
+            c.indexes.push_back(make_index(spec));
+        } catch (const std::exception& e) {
+            std::cerr << "[DB] skipping index " << spec.dump() << ": " << e.what() << "\n";
+        }
+    }
+}
+
+// Adds a document (and its index entries) to c, which may already have
+// indexes.
+static void add_loaded_doc(InMemoryCollection& c, json doc) {
+    if (!doc.is_object() || !doc.contains("id") || !doc["id"].is_number_integer()) return;
+    int id = doc["id"].get<int>();
+    auto stored = std::make_shared<const StoredDoc>(std::move(doc));
+    if (!c.docs.insert(id, stored)) return;
+    c.doc_added(id, stored->value);
+    c.nextId.observe(id);
+}
+
+static void fill_collection(InMemoryCollection& c, const json& arr) {
+    for (const auto& doc : arr) add_loaded_doc(c, doc);
+}
+
+static InMemoryCollection collection_from_json(const json& arr, int nextId,
+                                                const json& indexSpecs = json::array()) {
+    InMemoryCollection c;
+    c.nextId = IdAllocator(nextId);
+    add_indexes(c, indexSpecs);
+    fill_collection(c, arr);
+    return c;
+}
+
+// Writes to a temp file and renames it over path, so a crash mid-write
+// never leaves a truncated file behind.
+static bool write_file_atomically(const fs::path& path, const std::string& body) {
+    fs::path tmpPath = path;
+    tmpPath += ".tmp";
+    FILE* f = std::fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        std::cerr << "[DB] cannot write " << tmpPath << "\n";
+        return false;
+    }
+    bool good = std::fwrite(body.data(), 1, body.size(), f) == body.size();
+    good = (std::fflush(f) == 0) && good;
+    good = (::fsync(fileno(f)) == 0) && good;
+    std::fclose(f);
+    if (!good) {
+        std::cerr << "[DB] short write to " << tmpPath << "\n";
+        return false;
+    }
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        std::cerr << "[DB] rename " << tmpPath << " failed: " << ec.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// ---- data files ----
+//
+// <name>.snap holds a collection: "TDBS", the format version and the
+// codec id, then one compressed block with a msgpack header
+// {"count","indexes","nextId"} followed by count msgpack documents.
+//
+// <name>.tslog holds a time series: "TDBL" and the format version, then
+// frames appended over time, each a codec id, a little-endian u32 length
+// and a compressed block of msgpack values. The first frame is
+// {"timeSeries": spec}, every later one a batch of records.
+//
+// Older releases wrote <name>.json and <name>.series as text. Both are
+// still read; a collection is rewritten as .snap on its next save, and a
+// series log is converted when it is loaded.
+
+static constexpr char kSnapMagic[] = "TDBS";
+static constexpr char kLogMagic[] = "TDBL";
+static constexpr char kFileFormat = 1;
+
+static std::string file_header(const char* magic) {
+    std::string h(magic, 4);
+    h += kFileFormat;
+    return h;
+}
+
+static bool check_header(std::istream& in, const char* magic) {
+    char h[5];
+    return in.read(h, sizeof(h)) && std::equal(h, h + 4, magic) && h[4] == kFileFormat;
+}
+
+static const StorageCodec& codec_of(uint8_t id) {
+    const StorageCodec* codec = find_codec(id);
+    if (!codec) throw std::runtime_error("unknown codec id " + std::to_string(id));
+    return *codec;
+}
+
+// One log frame holding values.
+static std::string log_frame(const StorageCodec& codec, const std::vector<json>& values) {
+    std::string raw;
+    for (const auto& v : values) json::to_msgpack(v, raw);
+    std::string frame(5, '\0');
+    frame[0] = static_cast<char>(codec.id());
+    codec.compress(raw, frame);
+    uint32_t n = static_cast<uint32_t>(frame.size() - 5);
+    for (int i = 0; i < 4; ++i) frame[1 + i] = static_cast<char>(n >> (8 * i));
+    return frame;
+}
+
+// Streams a collection's file: meta gets {"indexes","nextId"} and doc
+// each document, decompressed and decoded as the file is read. Returns
+// false if the collection has no file.
+static bool read_collection_file(const fs::path& dir, const std::string& name,
+                                 const std::function<void(const json&)>& meta,
+                                 const std::function<void(json)>& doc) {
+    std::ifstream in(dir / (name + ".snap"), std::ios::binary);
+    if (in) {
+        if (!check_header(in, kSnapMagic)) throw std::runtime_error("not a snapshot file");
+        char id;
+        if (!in.get(id)) throw std::runtime_error("truncated snapshot file");
+        std::unique_ptr<std::streambuf> buf = codec_of(static_cast<uint8_t>(id)).decompressor(*in.rdbuf());
+        std::istream raw(buf.get());
+        json header = json::from_msgpack(raw, false);
+        meta(header);
+        size_t count = header.value("count", size_t(0));
+        for (size_t i = 0; i < count; ++i) doc(json::from_msgpack(raw, false));
+        return true;
+    }
+
+    std::ifstream legacy(dir / (name + ".json"));
+    if (!legacy) return false;
+    json j = json::parse(legacy);
+    meta(j);
+    for (auto& d : j.value("docs", json::array())) doc(std::move(d));
+    return true;
+}
+
+// ---- InMemoryCollection ----
+
+void InMemoryCollection::doc_added(int id, const json& doc) {
+    if (!bulkLoading) {
+        for (auto& idx : indexes) idx->insert(id, doc);
+    }
+    bytes += approx_bytes(doc);
+}
+
+void InMemoryCollection::doc_removed(int id, const json& doc) {
+    if (!bulkLoading) {
+        for (auto& idx : indexes) idx->remove(id, doc);
+    }
+    size_t n = approx_bytes(doc);
+    bytes = n > bytes ? 0 : bytes - n;
+}
+
+json InMemoryCollection::index_specs() const {
+    json arr = json::array();
+    for (auto& idx : indexes) arr.push_back(idx->spec());
+    return arr;
+}
+
+// ---- filters ----
+
+// Below this many documents a scan is cheaper than waking the scan pool.
+static constexpr size_t kParallelScanMin = 4096;
+
+// Ids a filter on the primary key can only match: an integer, an $in list
+// of them, or a closed range no wider than the collection (the cluster
+// pages through ids this way). The predicate still checks each one.
+static bool id_candidates(const json& cond, size_t docCount, std::vector<int>& ids) {
+    if (cond.is_number_integer()) {
+        ids.push_back(cond.get<int>());
+        return true;
+    }
+    if (!cond.is_object()) return false;
+    auto in = cond.find("$in");
+    if (in != cond.end() && in->is_array()) {
+        for (const auto& v : *in) {
+            if (!v.is_number_integer()) return false;
+            ids.push_back(v.get<int>());
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return true;
+    }
+    int64_t lo = 0, hi = 0;
+    bool hasLo = false, hasHi = false;
+    for (auto it = cond.begin(); it != cond.end(); ++it) {
+        if (!it->is_number_integer()) continue;
+        // Clamped just past the range of ids, so +-1 cannot overflow.
+        int64_t v = it->is_number_unsigned()
+                        ? (int64_t)std::min<uint64_t>(it->get<uint64_t>(), uint64_t(INT_MAX) + 1)
+                        : std::clamp<int64_t>(it->get<int64_t>(), int64_t(INT_MIN) - 1, int64_t(INT_MAX) + 1);
+        if (it.key() == "$gte" || it.key() == "$gt") {
+            int64_t b = it.key() == "$gt" ? v + 1 : v;
+            lo = hasLo ? std::max(lo, b) : b;
+            hasLo = true;
+        } else if (it.key() == "$lte" || it.key() == "$lt") {
+            int64_t b = it.key() == "$lt" ? v - 1 : v;
+            hi = hasHi ? std::min(hi, b) : b;
+            hasHi = true;
+        }
+    }
+    if (!hasLo || !hasHi) return false;
+    if (lo > hi) return true;
+    lo = std::max<int64_t>(lo, INT_MIN);
+    hi = std::min<int64_t>(hi, INT_MAX);
+    if (uint64_t(hi - lo) >= docCount) return false;    // a scan is no worse
+    for (int64_t id = lo; id <= hi; ++id) ids.push_back((int)id);
+    return true;
+}
+
+// Takes the primary key if the filter pins it, else the first filter
+// field that has a usable secondary index.
+bool Database::plan_candidates(InMemoryCollection& c, const json& filter, size_t limit,
+                               std::vector<int>& ids) {
+    if (!filter.is_object()) return false;
+    auto id = filter.find("id");
+    if (id != filter.end()) {
+        if (id_candidates(*id, c.docs.size(), ids)) return true;
+        ids.clear();
+    }
+    if (c.indexes.empty() || c.bulkLoading) return false;
+    for (auto it = filter.begin(); it != filter.end(); ++it) {
+        for (auto& idx : c.indexes) {
+            if (idx->field() != it.key()) continue;
+            // The index may stop early only if it alone decides the match.
+            size_t maxOut = filter.size() == 1 ? limit : 0;
+            if (idx->lookup(it.value(), ids, maxOut)) return true;
+            ids.clear();
+        }
+    }
+    return false;
+}
+
+// Calls fn for every document matching filter, up to limit (0 = no limit).
+// Every document examined is charged to the request's scan budget; once
+// it runs out, fn is not called at all unless the budget allows partial
+// results.
+void Database::for_each_match(InMemoryCollection& c, const json& filter, size_t limit,
+                              const std::function<void(int, const DocPtr&)>& fn) {
+    Predicate pred(filter);
+    // Collect first: fn may write back to the map, which must not happen
+    // while the scan holds a shard lock.
+    std::vector<std::pair<int, DocPtr>> matches;
+    std::vector<int> candidates;
+    if (plan_candidates(c, filter, limit, candidates)) {
+        for (int id : candidates) {
+            if (budget && !budget->step()) break;
+            DocPtr doc = c.docs.get(id);
+            if (!doc || !pred.matches(doc->value)) continue;
+            matches.emplace_back(id, std::move(doc));
+            if (limit && matches.size() >= limit) break;
+        }
+    } else if (scanPool && !limit && c.docs.size() >= kParallelScanMin) {
+        parallel_scan(c, pred, matches);
+    } else {
+        c.docs.for_each([&](int id, const DocPtr& doc) {
+            if (budget && !budget->step()) return false;
+            if (pred.matches(doc->value)) matches.emplace_back(id, doc);
+            return !limit || matches.size() < limit;
+        });
+    }
+    if (budget && budget->exhausted() && !budget->allowPartial) return;
+    for (auto& [id, doc] : matches) fn(id, doc);
+}
+
+// Each pool task scans one shard into its own result list; the lists are
+// concatenated in shard order, the same order a sequential scan produces.
+void Database::parallel_scan(InMemoryCollection& c, const Predicate& pred,
+                             std::vector<std::pair<int, DocPtr>>& matches) {
+    std::vector<std::vector<std::pair<int, DocPtr>>> parts(c.docs.shard_count());
+    scanPool->run(parts.size(), [&](size_t shard) {
+        c.docs.for_each_in_shard(shard, [&](int id, const DocPtr& doc) {
+            if (budget && !budget->step()) return false;
+            if (pred.matches(doc->value)) parts[shard].emplace_back(id, doc);
+            return true;
+        });
+    });
+
+    size_t total = 0;
+    for (auto& part : parts) total += part.size();
+    matches.reserve(total);
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(matches));
+    }
+}
+
+// Points Database::budget at a request's budget for the scope's lifetime.
+class BudgetScope {
+public:
+    BudgetScope(ScanBudget*& slot, ScanBudget& b) : slot(slot), prev(slot) { slot = &b; }
+    ~BudgetScope() { slot = prev; }
+
+private:
+    ScanBudget*& slot;
+    ScanBudget* prev;
+};
+
+// Result of a request whose scan ran out of budget: an error, or for a
+// read that allows it, what was found so far marked partial.
+static json over_budget(const ScanBudget& b, const std::string& action, json result) {
+    bool read = action == "read" || action == "query";
+    if (read && b.allowPartial && result.value("status", "") == "ok") {
+        result.erase("etag");   // a partial answer must not be revalidated
+        result["partial"] = true;
+        result["reason"] = ScanBudget::describe(b.reason());
+        return result;
+    }
+    return {{"status","error"},{"message",ScanBudget::describe(b.reason())},{"scanned",b.scanned()}};
+}
+
+// ---- actions ----
+
+json Database::handle_create(const std::string& coll, const json& data) {
+    if (!data.is_object())
+        return {{"status","error"},{"message","data must be object"}};
+
+    auto& c = get_collection(coll);
+    json doc = data;
+
+    int id;
+    if (!doc.contains("id") || !doc["id"].is_number_integer()) {
+        id = c.nextId.allocate();
+        doc["id"] = id;
+    } else {
+        id = doc["id"].get<int>();
+        if (c.docs.contains(id)) {
+            return {{"status","error"},{"message","id already exists"}};
+        }
+        c.nextId.observe(id);
+    }
+
+    auto stored = std::make_shared<const StoredDoc>(std::move(doc));
+    c.docs.insert(id, stored);
+    c.doc_added(id, stored->value);
+    update_views(coll, nullptr, &stored->value);
+    return {{"status","ok"},{"data",stored->value}};
+}
+
+static bool parse_ids(const json& arr, std::vector<int>& ids) {
+    if (!arr.is_array()) return false;
+    ids.reserve(arr.size());
+    for (const auto& v : arr) {
+        if (!v.is_number_integer()) return false;
+        ids.push_back(v.get<int>());
+    }
+    return true;
+}
+
+// Counts and limits. json built in C++ from an int is signed, so in-process
+// callers' values would be lost to an is_number_unsigned() check.
+static bool non_negative(const json& v) {
+    return v.is_number_unsigned() || (v.is_number_integer() && v.get<int64_t>() >= 0);
+}
+
+static size_t query_limit(const json& options) {
+    if (options.contains("limit") && non_negative(options["limit"]))
+        return options["limit"].get<size_t>();
+    return 0;
+}
+
+// Responses built from stored documents come in two forms: json for
+// in-process callers, and bytes assembled from each document's cached
+// serialization for the wire. Both match json::dump() key order.
+static json data_of(const DocPtr& doc) {
+    json result = {{"status","ok"},{"data", doc ? doc->value : json(nullptr)}};
+    if (doc) result["etag"] = doc->etag();
+    return result;
+}
+
+static json items_of(const std::vector<DocPtr>& docs) {
+    json arr = json::array();
+    for (const auto& doc : docs) arr.push_back(doc ? doc->value : json(nullptr));
+    return {{"status","ok"},{"items",arr}};
+}
+
+static std::string render_data(const DocPtr& doc) {
+    if (!doc) return "{\"data\":null,\"status\":\"ok\"}";
+    std::string out = "{\"data\":";
+    out += doc->bytes();
+    out += ",\"etag\":\"" + doc->etag() + "\",\"status\":\"ok\"}";
+    return out;
+}
+
+// lead: members rendered ahead of "items", e.g. "\"etag\":\"...\",".
+static std::string render_items(const std::vector<DocPtr>& docs, const std::string& lead = "") {
+    size_t n = 32 + lead.size();
+    for (const auto& doc : docs) n += (doc ? doc->bytes().size() : 4) + 1;
+
+    std::string out;
+    out.reserve(n);
+    out += "{" + lead + "\"items\":[";
+    for (size_t i = 0; i < docs.size(); ++i) {
+        if (i) out += ',';
+        out += docs[i] ? docs[i]->bytes() : "null";
+    }
+    out += "],\"status\":\"ok\"}";
+    return out;
+}
+
+// Conditional reads: a caller that sends back the etag of a response it
+// holds as options.ifNoneMatch gets {"status":"not_modified","etag"} if
+// the response would be the same. Reads are tagged by the document they
+// return, queries by their collection's generation.
+static bool if_none_match(const json& options, const std::string& etag) {
+    if (!options.is_object()) return false;
+    auto it = options.find("ifNoneMatch");
+    return it != options.end() && it->is_string() && it->get_ref<const std::string&>() == etag;
+}
+
+static json not_modified(const std::string& etag) {
+    return {{"status","not_modified"},{"etag",etag}};
+}
+
+static json read_result(const DocPtr& doc, const json& options) {
+    if (doc && if_none_match(options, doc->etag())) return not_modified(doc->etag());
+    return data_of(doc);
+}
+
+static std::string render_read(const DocPtr& doc, const json& options) {
+    if (doc && if_none_match(options, doc->etag())) return not_modified(doc->etag()).dump();
+    return render_data(doc);
+}
+
+static std::string etag_member(const std::string& etag) {
+    return "\"etag\":\"" + etag + "\",";
+}
+
+// The generation counter starts over on every open, so the tag carries a
+// per-process random part; a tag from before a restart never matches.
+uint64_t Database::new_epoch() {
+    std::random_device rd;
+    return (uint64_t(rd()) << 32) ^ rd();
+}
+
+std::string Database::collection_etag(const std::string& coll) {
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "%016llx-%llu", (unsigned long long)epoch,
+                  (unsigned long long)generations[coll]);
+    return buf;
+}
+
+std::vector<DocPtr> Database::find_docs(const std::string& coll, const json& filter, size_t limit) {
+    std::vector<DocPtr> docs;
+    InMemoryCollection* c = find_collection(coll);
+    if (c) for_each_match(*c, filter, limit, [&](int, const DocPtr& doc) { docs.push_back(doc); });
+    return docs;
+}
+
+json Database::handle_read(const std::string& coll, const json& filter, const json& options) {
+    std::vector<DocPtr> docs = find_docs(coll, filter, 1);
+    return read_result(docs.empty() ? nullptr : docs[0], options);
+}
+
+json Database::handle_mget(const std::string& coll, const json& ids) {
+    std::vector<int> keys;
+    if (!parse_ids(ids, keys))
+        return {{"status","error"},{"message","data must be an array of ids"}};
+
+    std::vector<DocPtr> docs;
+    InMemoryCollection* c = find_collection(coll);
+    for (int id : keys) docs.push_back(c ? c->docs.get(id) : nullptr);
+    return items_of(docs);
+}
+
+json Database::handle_query(const std::string& coll, const json& filter, const json& options) {
+    std::vector<LookupStage> lookups;
+    std::string err;
+    if (!parse_lookups(options, lookups, err))
+        return {{"status","error"},{"message",err}};
+
+    std::string etag = query_etag(coll, lookups);
+    if (if_none_match(options, etag)) return not_modified(etag);
+    json result = items_of(find_docs(coll, filter, query_limit(options)));
+    for (const auto& stage : lookups) join_lookup(result["items"], stage);
+    result["etag"] = etag;
+    return result;
+}
+
+// ---- lookup ----
+
+// options.lookup is one stage or an array of them:
+//   {"from": "User", "localField": "players", "foreignField": "id", "as": "playerDocs"}
+// foreignField defaults to "id".
+bool Database::parse_lookups(const json& options, std::vector<LookupStage>& out, std::string& err) {
+    if (!options.is_object() || !options.contains("lookup")) return true;
+    json stages = options["lookup"];
+    if (stages.is_object()) stages = json::array({stages});
+    if (!stages.is_array()) {
+        err = "lookup must be an object or an array of objects";
+        return false;
+    }
+    for (const auto& st : stages) {
+        auto str = [&](const char* key) {
+            return st.is_object() && st.contains(key) && st[key].is_string() ? st[key].get<std::string>() : "";
+        };
+        LookupStage stage;
+        stage.from = str("from");
+        stage.as = str("as");
+        std::string local = str("localField");
+        stage.foreignField = st.is_object() && st.contains("foreignField") ? str("foreignField") : "id";
+        if (!valid_collection_name(stage.from) || local.empty() || stage.as.empty() || stage.foreignField.empty()) {
+            err = "lookup needs from, localField and as (strings)";
+            return false;
+        }
+        stage.localField = FieldPath(local);
+        out.push_back(std::move(stage));
+    }
+    return true;
+}
+
+// A joined query changes when any collection it reads does.
+std::string Database::query_etag(const std::string& coll, const std::vector<LookupStage>& lookups) {
+    std::string etag = collection_etag(coll);
+    for (const auto& stage : lookups) etag += "." + std::to_string(generations[stage.from]);
+    return etag;
+}
+
+// Embeds, under stage.as in every item, the documents of stage.from whose
+// foreignField equals the item's localField (or any element of it, in
+// element order). All keys are fetched at once: by primary key when
+// joining on id, otherwise through one $in filter, which an index on
+// foreignField serves.
+void Database::join_lookup(json& items, const LookupStage& stage) {
+    std::vector<json> keys;
+    std::unordered_set<std::string> seen;
+    auto collect = [&](const json& v) {
+        if ((v.is_primitive() && !v.is_null()) && seen.insert(v.dump()).second) keys.push_back(v);
+    };
+    for (const auto& item : items) {
+        const json* v = item.is_object() ? stage.localField.resolve(item) : nullptr;
+        if (!v) continue;
+        if (v->is_array()) for (const auto& e : *v) collect(e);
+        else collect(*v);
+    }
+
+    std::unordered_map<std::string, std::vector<DocPtr>> byKey;
+    InMemoryCollection* c = keys.empty() ? nullptr : find_collection(stage.from);
+    if (c && stage.foreignField == "id") {
+        for (const auto& k : keys) {
+            if (!k.is_number_integer()) continue;
+            if (DocPtr doc = c->docs.get(k.get<int>())) byKey[k.dump()].push_back(std::move(doc));
+        }
+    } else if (c) {
+        FieldPath foreign(stage.foreignField);
+        json filter = {{stage.foreignField, {{"$in", keys}}}};
+        for_each_match(*c, filter, 0, [&](int, const DocPtr& doc) {
+            if (const json* v = foreign.resolve(doc->value)) byKey[v->dump()].push_back(doc);
+        });
+    }
+
+    for (auto& item : items) {
+        if (!item.is_object()) continue;
+        json joined = json::array();
+        auto append = [&](const json& k) {
+            auto it = byKey.find(k.dump());
+            if (it == byKey.end()) return;
+            for (const auto& doc : it->second) joined.push_back(doc->value);
+        };
+        if (const json* v = stage.localField.resolve(item)) {
+            if (v->is_array()) for (const auto& e : *v) append(e);
+            else append(*v);
+        }
+        item[stage.as] = std::move(joined);
+    }
+}
+
+json Database::handle_update(const std::string& coll, const json& filter, const json& data,
+                             std::vector<int>& touched) {
+    if (!data.is_object())
+        return {{"status","error"},{"message","data must be object"}};
+
+    InMemoryCollection* pc = find_collection(coll);
+    if (!pc)
+        return {{"status","ok"},{"updated",0}};
+
+    InMemoryCollection& c = *pc;
+    int count = 0;
+    for_each_match(c, filter, 0, [&](int id, const DocPtr& doc) {
+        json next = doc->value;
+        for (auto it = data.begin(); it != data.end(); ++it) {
+            if (it.key() == "id") continue;     // the primary key is immutable
+            next[it.key()] = it.value();
+        }
+        auto stored = std::make_shared<const StoredDoc>(std::move(next));
+        c.doc_removed(id, doc->value);
+        c.doc_added(id, stored->value);
+        update_views(coll, &doc->value, &stored->value);
+        c.docs.replace(id, std::move(stored));
+        touched.push_back(id);
+        ++count;
+    });
+    return {{"status","ok"},{"updated",count}};
+}
+
+json Database::handle_delete(const std::string& coll, const json& filter,
+                             std::vector<int>& touched) {
+    InMemoryCollection* pc = find_collection(coll);
+    if (!pc)
+        return {{"status","ok"},{"deleted",0}};
+
+    InMemoryCollection& c = *pc;
+    for_each_match(c, filter, 0, [&](int id, const DocPtr&) { touched.push_back(id); });
+    for (int id : touched) {
+        if (DocPtr doc = c.docs.erase(id)) {
+            c.doc_removed(id, doc->value);
+            update_views(coll, &doc->value, nullptr);
+        }
+    }
+    return {{"status","ok"},{"deleted",(int)touched.size()}};
+}
+
+json Database::handle_create_index(const std::string& coll, const json& spec) {
+    std::unique_ptr<SecondaryIndex> idx;
+    try {
+        idx = make_index(spec);
+    } catch (const std::exception& e) {
+        return {{"status","error"},{"message",e.what()}};
+    }
+
+    auto& c = get_collection(coll);
+    for (auto& existing : c.indexes) {
+        if (existing->spec() == spec)
+            return {{"status","ok"},{"created",false}};
+    }
+    c.docs.for_each([&](int id, const DocPtr& doc) {
+        idx->insert(id, doc->value);
+        return true;
+    });
+    c.indexes.push_back(std::move(idx));
+    c.dirty = true;
+    flush();
+    return {{"status","ok"},{"created",true}};
+}
+
+json Database::handle_drop_index(const std::string& coll, const json& spec) {
+    InMemoryCollection* c = find_collection(coll);
+    if (!c)
+        return {{"status","ok"},{"dropped",0}};
+
+    auto& idx = c->indexes;
+    std::string field = spec.value("field", "");
+    size_t before = idx.size();
+    idx.erase(std::remove_if(idx.begin(), idx.end(),
+                             [&](const std::unique_ptr<SecondaryIndex>& i) { return i->field() == field; }),
+              idx.end());
+    int dropped = (int)(before - idx.size());
+    if (dropped) {
+        c->dirty = true;
+        flush();
+    }
+    return {{"status","ok"},{"dropped",dropped}};
+}
+
+// ---- time series ----
+
+json Database::handle_create_time_series(const std::string& coll, const json& spec) {
+    if (series.count(coll))
+        return {{"status","ok"},{"created",false}};
+    if (collections.count(coll) || views.count(coll))
+        return {{"status","error"},{"message","a collection or view with this name exists"}};
+
+    try {
+        TimeSeries ts = TimeSeries::from_spec(spec);
+        std::string body = file_header(kLogMagic) + log_frame(*codec, {json{{"timeSeries", ts.spec()}}});
+        if (!write_file_atomically(fs::path(dataDir) / (coll + ".tslog"), body))
+            return {{"status","error"},{"message","cannot write time series file"}};
+        series.emplace(coll, std::move(ts));
+    } catch (const std::exception& e) {
+        return {{"status","error"},{"message",e.what()}};
+    }
+    return {{"status","ok"},{"created",true}};
+}
+
+// Time series accept append (one record or an array), read and query;
+// query options: limit, desc (newest first).
+json Database::apply_time_series(const std::string& action, const std::string& coll, TimeSeries& ts,
+                                 const json& filter, const json& data, const json& options) {
+    if (action == "append") {
+        std::vector<json> records;
+        if (data.is_array()) records.assign(data.begin(), data.end());
+        else records.push_back(data);
+        for (const auto& r : records) {
+            if (!ts.valid_record(r))
+                return {{"status","error"},{"message","record needs a numeric " + ts.time_field()}};
+        }
+
+        // On disk first, so memory never holds records a restart would lose.
+        if (!append_series_file(coll, records))
+            return {{"status","error"},{"message","cannot append to time series file"}};
+        for (auto& r : records) {
+            update_views(coll, nullptr, &r);
+            ts.append(std::move(r));
+        }
+
+        bump_generation(coll);
+        if (mutationListener) mutationListener(coll, {});
+        return {{"status","ok"},{"appended",records.size()}};
+    }
+
+    if (action == "read" || action == "query") {
+        size_t limit = action == "read" ? 1 : query_limit(options);
+        bool desc = options.is_object() && options.value("desc", false);
+        std::vector<const json*> found = ts.scan(filter, limit, desc);
+        if (action == "read")
+            return {{"status","ok"},{"data", found.empty() ? json(nullptr) : *found[0]}};
+
+        json arr = json::array();
+        for (const json* r : found) arr.push_back(*r);
+        return {{"status","ok"},{"items",arr}};
+    }
+
+    return {{"status","error"},{"message","action not supported on a time series"}};
+}
+
+// ---- views ----
+
+json Database::handle_create_view(const std::string& name, const json& spec) {
+    auto existing = views.find(name);
+    if (existing != views.end()) {
+        if (existing->second.spec() == spec) return {{"status","ok"},{"created",false}};
+        return {{"status","error"},{"message","a view with this name and another spec exists"}};
+    }
+    if (collections.count(name) || series.count(name))
+        return {{"status","error"},{"message","a collection with this name exists"}};
+
+    try {
+        MaterializedView view = MaterializedView::from_spec(spec);
+        if (!valid_collection_name(view.source()) || view.source() == name || views.count(view.source()))
+            return {{"status","error"},{"message","view source must be a collection or time series"}};
+        if (!write_file_atomically(fs::path(dataDir) / (name + ".view"), spec.dump()))
+            return {{"status","error"},{"message","cannot write view file"}};
+        build_view(view);
+        views.emplace(name, std::move(view));
+    } catch (const std::exception& e) {
+        return {{"status","error"},{"message",e.what()}};
+    }
+    bump_generation(name);
+    return {{"status","ok"},{"created",true}};
+}
+
+json Database::handle_drop_view(const std::string& name) {
+    if (!views.erase(name)) return {{"status","ok"},{"dropped",false}};
+    std::error_code ec;
+    fs::remove(fs::path(dataDir) / (name + ".view"), ec);
+    bump_generation(name);
+    if (mutationListener) mutationListener(name, {});
+    return {{"status","ok"},{"dropped",true}};
+}
+
+// Replays the whole source into an empty view.
+void Database::build_view(MaterializedView& view) {
+    view.clear();
+    auto ts = series.find(view.source());
+    if (ts != series.end()) {
+        for (const json* r : ts->second.scan(json::object(), 0, false)) view.apply(nullptr, r);
+        return;
+    }
+    if (InMemoryCollection* c = find_collection(view.source())) {
+        c->docs.for_each([&](int, const DocPtr& doc) {
+            view.apply(nullptr, &doc->value);
+            return true;
+        });
+    }
+}
+
+void Database::update_views(const std::string& coll, const json* before, const json* after) {
+    for (auto& [name, view] : views) {
+        if (view.source() == coll) view.apply(before, after);
+    }
+}
+
+// Views are read like collections (read, query with limit and
+// ifNoneMatch) and are otherwise read-only.
+json Database::apply_view(const std::string& action, const std::string& name, const MaterializedView& view,
+                          const json& filter, const json& options) {
+    if (action == "read") {
+        std::vector<json> rows = view.rows(filter, 1);
+        return {{"status","ok"},{"data", rows.empty() ? json(nullptr) : rows[0]}};
+    }
+    if (action == "query") {
+        std::string etag = collection_etag(name);
+        if (if_none_match(options, etag)) return not_modified(etag);
+        json arr = json::array();
+        for (auto& r : view.rows(filter, query_limit(options))) arr.push_back(std::move(r));
+        return {{"status","ok"},{"items",arr},{"etag",etag}};
+    }
+    if (action == "dropView") return handle_drop_view(name);
+    return {{"status","error"},{"message","views are read-only"}};
+}
+
+// Hands out count consecutive ids from the collection's sequence, which is
+// persisted before the ids are returned so they are never issued twice.
+json Database::handle_reserve_ids(const std::string& coll, const json& data) {
+    int count = 1;
+    if (data.is_object() && data.contains("count")) {
+        if (!data["count"].is_number_integer() || data["count"].get<int64_t>() <= 0
+            || data["count"].get<int64_t>() > 1000000)
+            return {{"status","error"},{"message","count must be between 1 and 1000000"}};
+        count = data["count"].get<int>();
+    }
+
+    auto& c = get_collection(coll);
+    int first = c.nextId.reserve(count);
+    c.dirty = true;
+    flush();
+    if (c.dirty)
+        return {{"status","error"},{"message","cannot persist id sequence"}};
+    return {{"status","ok"},{"first",first},{"count",count}};
+}
+
+// Inserts a batch of documents without maintaining indexes or rewriting
+// the collection file. The batch sent with options.done rebuilds the
+// indexes and persists the collection, once for the whole load. Documents
+// whose id already exists are skipped.
+json Database::handle_bulk_load(const std::string& coll, const json& data, const json& options) {
+    if (!data.is_array())
+        return {{"status","error"},{"message","data must be an array of documents"}};
+    bool done = options.is_object() && options.value("done", false);
+
+    auto& c = get_collection(coll);
+    c.bulkLoading = true;
+    int loaded = 0;
+    int skipped = 0;
+    for (const auto& d : data) {
+        if (!d.is_object()) {
+            ++skipped;
+            continue;
+        }
+        json doc = d;
+        int id;
+        if (doc.contains("id") && doc["id"].is_number_integer()) {
+            id = doc["id"].get<int>();
+        } else {
+            id = c.nextId.allocate();
+            doc["id"] = id;
+        }
+        auto stored = std::make_shared<const StoredDoc>(std::move(doc));
+        if (!c.docs.insert(id, stored)) {
+            ++skipped;
+            continue;
+        }
+        c.nextId.observe(id);
+        c.doc_added(id, stored->value);
+        update_views(coll, nullptr, &stored->value);
+        ++loaded;
+    }
+    if (loaded) {
+        c.dirty = true;
+        bump_generation(coll);
+        if (mutationListener) mutationListener(coll, {});
+    }
+
+    if (done) {
+        c.bulkLoading = false;
+        for (auto& idx : c.indexes) idx->clear();
+        c.docs.for_each([&](int id, const DocPtr& doc) {
+            for (auto& idx : c.indexes) idx->insert(id, doc->value);
+            return true;
+        });
+        flush();
+        if (c.dirty)
+            return {{"status","error"},{"message","cannot persist collection"}};
+    }
+    return {{"status","ok"},{"loaded",loaded},{"skipped",skipped}};
+}
+
+// Export pages stay well under the protocol's 64 KiB frame limit.
+static constexpr size_t kExportPageBytes = 48 * 1024;
+static constexpr size_t kExportPageMaxBytes = 60 * 1024;
+
+// One page of a collection export. The walk goes shard by shard through
+// the doc map; options.cursor ({"shard","offset"}, from the previous page)
+// resumes it and the returned cursor is null after the last page. Pages
+// hold up to options.maxBytes of serialized documents. Documents written
+// while an export runs may be missed or sent twice.
+bool Database::export_page(const std::string& coll, const json& options,
+                           std::vector<DocPtr>& docs, json& cursor) {
+    size_t shard = 0;
+    size_t offset = 0;
+    size_t maxBytes = kExportPageBytes;
+    if (options.is_object()) {
+        auto cur = options.find("cursor");
+        if (cur != options.end() && !cur->is_null()) {
+            if (!cur->is_object() || !non_negative(cur->value("shard", json()))
+                || !non_negative(cur->value("offset", json())))
+                return false;
+            shard = (*cur)["shard"].get<size_t>();
+            offset = (*cur)["offset"].get<size_t>();
+        }
+        if (options.contains("maxBytes") && non_negative(options["maxBytes"]))
+            maxBytes = std::min(options["maxBytes"].get<size_t>(), kExportPageMaxBytes);
+    }
+
+    cursor = nullptr;
+    InMemoryCollection* c = find_collection(coll);
+    if (!c) return true;
+
+    size_t used = 0;
+    bool full = false;
+    for (; shard < c->docs.shard_count(); ++shard, offset = 0) {
+        size_t seen = 0;
+        c->docs.for_each_in_shard(shard, [&](int, const DocPtr& doc) {
+            if (seen++ < offset) return true;
+            size_t n = doc->bytes().size() + 1;
+            if (!docs.empty() && used + n > maxBytes) {
+                full = true;
+                return false;
+            }
+            docs.push_back(doc);
+            used += n;
+            ++offset;
+            return true;
+        });
+        if (full) break;
+    }
+    if (full) cursor = {{"shard", shard}, {"offset", offset}};
+    return true;
+}
+
+json Database::handle_export(const std::string& coll, const json& options) {
+    std::vector<DocPtr> docs;
+    json cursor;
+    if (!export_page(coll, options, docs, cursor))
+        return {{"status","error"},{"message","invalid cursor"}};
+    json result = items_of(docs);
+    result["cursor"] = cursor;
+    return result;
+}
+
+void Database::bump_generation(const std::string& coll) {
+    ++generations[coll];
+    // Views over coll change with it.
+    for (auto& [name, view] : views) {
+        if (view.source() != coll) continue;
+        ++generations[name];
+        if (mutationListener) mutationListener(name, {});
+    }
+}
+
+void Database::set_mutation_listener(MutationListener listener) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    mutationListener = std::move(listener);
+}
+
+void Database::set_scan_threads(size_t threads) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (threads <= 1) scanPool.reset();
+    else scanPool = std::make_unique<ScanPool>(threads);
+}
+
+void Database::enable_query_cache(size_t maxEntries) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (maxEntries == 0) queryCache.reset();
+    else queryCache = std::make_unique<QueryCache>(maxEntries);
+}
+
+json Database::handle_stats() {
+    json colls = json::object();
+    size_t residentBytes = 0;
+    for (auto& [name, c] : collections) {
+        colls[name] = {
+            {"documents", c.resident ? c.docs.size() : c.spilledDocs},
+            {"generation", generations[name]},
+            {"resident", c.resident},
+            {"bytes", c.bytes},
+            {"nextId", c.nextId.peek()},
+            {"indexes", c.index_specs()},
+            {"bulkLoading", c.bulkLoading}
+        };
+        if (c.resident) residentBytes += c.bytes;
+    }
+    for (auto& [name, ts] : series) {
+        colls[name] = ts.stats();
+        colls[name]["generation"] = generations[name];
+    }
+    for (auto& [name, view] : views) {
+        colls[name] = view.stats();
+        colls[name]["generation"] = generations[name];
+    }
+    json result = {{"status","ok"},{"collections",colls}};
+    result["memory"] = {
+        {"budget", memoryBudget},
+        {"residentBytes", residentBytes},
+        {"evictions", evictions},
+        {"faults", faults},
+        {"faultMicrosTotal", faultMicrosTotal},
+        {"faultMicrosMax", faultMicrosMax},
+        {"faultMicrosAvg", faults ? faultMicrosTotal / faults : 0}
+    };
+    if (queryCache) result["queryCache"] = queryCache->stats();
+    return result;
+}
+
+void Database::set_memory_budget(size_t bytes) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    memoryBudget = bytes;
+    enforce_memory_budget();
+}
+
+void Database::set_storage_codec(const std::string& name) {
+    const StorageCodec* c = find_codec(name);
+    if (!c) throw std::invalid_argument("unknown storage codec: " + name);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    codec = c;
+}
+
+void Database::set_query_limits(size_t maxScan, int maxTimeMs) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    defaultMaxScan = maxScan;
+    defaultMaxTimeMs = maxTimeMs;
+}
+
+// ---- running operations ----
+
+Database::OpScope::OpScope(Database& db, const json& req)
+    : db(db), op(std::make_shared<RunningOp>()) {
+    op->action = req.value("action", "");
+    auto coll = req.find("collection");
+    if (coll != req.end() && coll->is_string()) op->collection = coll->get<std::string>();
+    op->start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(db.opsMtx);
+    id = db.nextOpId++;
+    db.ops.emplace(id, op);
+}
+
+Database::OpScope::~OpScope() {
+    std::lock_guard<std::mutex> lock(db.opsMtx);
+    db.ops.erase(id);
+}
+
+// currentOp and killOp; true if req was one of them.
+bool Database::handle_op_control(const json& req, json& result) {
+    auto action = req.find("action");
+    if (action == req.end()) return false;
+
+    if (*action == "currentOp") {
+        auto now = std::chrono::steady_clock::now();
+        json arr = json::array();
+        std::lock_guard<std::mutex> lock(opsMtx);
+        for (auto& [id, op] : ops) {
+            arr.push_back({
+                {"opId", id},
+                {"action", op->action},
+                {"collection", op->collection},
+                {"runningMs", std::chrono::duration_cast<std::chrono::milliseconds>(now - op->start).count()},
+                {"killed", op->killed.load()}
+            });
+        }
+        result = {{"status","ok"},{"ops",arr}};
+        return true;
+    }
+
+    if (*action == "killOp") {
+        json data = req.value("data", json::object());
+        if (!data.is_object() || !data.contains("opId") || !non_negative(data["opId"])) {
+            result = {{"status","error"},{"message","data.opId must be an operation id"}};
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(opsMtx);
+        auto it = ops.find(data["opId"].get<uint64_t>());
+        if (it != ops.end()) it->second->killed = true;
+        result = {{"status","ok"},{"killed",it != ops.end()}};
+        return true;
+    }
+    return false;
+}
+
+// Request options override the server-wide limits.
+// Only reads may settle for a partial result; a write over budget has to
+// fail before it touches anything.
+ScanBudget Database::make_budget(const json& options, const std::string& action,
+                                 const std::atomic<bool>* killed) const {
+    size_t maxScan = defaultMaxScan;
+    int maxTimeMs = defaultMaxTimeMs;
+    bool allowPartial = false;
+    bool read = action == "read" || action == "query";
+    if (options.is_object()) {
+        if (options.contains("maxScan") && non_negative(options["maxScan"]))
+            maxScan = options["maxScan"].get<size_t>();
+        if (options.contains("maxTimeMs") && non_negative(options["maxTimeMs"]))
+            maxTimeMs = options["maxTimeMs"].get<int>();
+        allowPartial = read && options.value("allowPartial", false);
+    }
+    return ScanBudget(maxScan, maxTimeMs, killed, allowPartial);
+}
+
+// ---- residency ----
+
+InMemoryCollection* Database::find_collection(const std::string& coll) {
+    auto it = collections.find(coll);
+    if (it == collections.end()) return nullptr;
+    InMemoryCollection& c = it->second;
+    if (!c.resident) fault_in(coll, c);
+    c.lastAccess = ++accessClock;
+    return &c;
+}
+
+InMemoryCollection& Database::get_collection(const std::string& coll) {
+    InMemoryCollection* c = find_collection(coll);
+    if (c) return *c;
+    InMemoryCollection& created = collections[coll];
+    created.lastAccess = ++accessClock;
+    return created;
+}
+
+void Database::fault_in(const std::string& name, InMemoryCollection& c) {
+    auto start = std::chrono::steady_clock::now();
+    try {
+        read_collection_file(dataDir, name, [](const json&) {},
+                             [&](json doc) { add_loaded_doc(c, std::move(doc)); });
+    } catch (const std::exception& e) {
+        std::cerr << "[DB] failed to fault in " << name << ": " << e.what() << "\n";
+    }
+    c.resident = true;
+    c.spilledDocs = 0;
+
+    auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    ++faults;
+    faultMicrosTotal += us;
+    faultMicrosMax = std::max(faultMicrosMax, us);
+}
+
+// Spills least recently used collections until resident bytes fit the
+// budget. The most recently used collection always stays resident.
+void Database::enforce_memory_budget() {
+    if (memoryBudget == 0) return;
+
+    size_t resident = 0;
+    std::vector<std::pair<uint64_t, std::string>> byAge;
+    for (auto& [name, c] : collections) {
+        if (!c.resident) continue;
+        resident += c.bytes;
+        byAge.emplace_back(c.lastAccess, name);
+    }
+    if (resident <= memoryBudget) return;
+
+    std::sort(byAge.begin(), byAge.end());
+    for (size_t i = 0; i + 1 < byAge.size() && resident > memoryBudget; ++i) {
+        InMemoryCollection& c = collections[byAge[i].second];
+        if (c.dirty) {
+            if (!save_collection(byAge[i].second, c)) continue;
+            c.dirty = false;
+        }
+        resident -= c.bytes;
+        c.spilledDocs = c.docs.size();
+        c.docs.clear();
+        for (auto& idx : c.indexes) idx->clear();
+        c.bytes = 0;
+        c.resident = false;
+        ++evictions;
+    }
+}
+
+json Database::dispatch(const json& req, const std::atomic<bool>* killed) {
+    if (!req.contains("action"))
+        return {{"status","error"},{"message","missing collection or action"}};
+
+    std::string action = req["action"].get<std::string>();
+    if (action == "stats")
+        return handle_stats();
+    if (action == "call")
+        return handle_call(req, killed);
+
+    if (!req.contains("collection"))
+        return {{"status","error"},{"message","missing collection or action"}};
+
+    std::string coll = req["collection"].get<std::string>();
+    json filter = req.value("filter", json::object());
+    json data = req.value("data", json::object());
+    json options = req.value("options", json::object());
+    return apply(action, coll, filter, data, options, killed);
+}
+
+json Database::apply(const std::string& action, const std::string& coll,
+                     const json& filter, const json& data, const json& options,
+                     const std::atomic<bool>* killed) {
+    if (!valid_collection_name(coll))
+        return {{"status","error"},{"message","invalid collection name"}};
+
+    ScanBudget scanBudget = make_budget(options, action, killed);
+    BudgetScope budgetScope(budget, scanBudget);
+    if (killed && *killed)      // killed while waiting for the lock
+        return {{"status","error"},{"message",ScanBudget::describe(ScanBudget::Reason::Killed)}};
+
+    if (action == "createTimeSeries")
+        return handle_create_time_series(coll, data);
+    if (action == "createView")
+        return handle_create_view(coll, data);
+    auto view = views.find(coll);
+    if (view != views.end() && action != "reset")
+        return apply_view(action, coll, view->second, filter, options);
+    auto ts = series.find(coll);
+    if (ts != series.end() && action != "reset") {
+        if (action != "query")
+            return apply_time_series(action, coll, ts->second, filter, data, options);
+        std::string etag = collection_etag(coll);
+        if (if_none_match(options, etag)) return not_modified(etag);
+        json found = apply_time_series(action, coll, ts->second, filter, data, options);
+        if (found.value("status", "") == "ok") found["etag"] = etag;
+        return found;
+    }
+
+    json result;
+    bool mutated = false;
+    std::vector<int> touched;
+    if (action == "create"){
+        result =  handle_create(coll, data);
+        mutated = (result["status"] == "ok");
+        if (mutated) touched.push_back(result["data"]["id"].get<int>());
+    }else if (action == "read"){
+        result = handle_read(coll, filter, options);
+    }else if (action == "mget"){
+        result = handle_mget(coll, data);
+    }else if (action == "query"){  
+        result = handle_query(coll, filter, options);
+    }else if (action == "update"){
+        result = handle_update(coll, filter, data, touched);
+        mutated = (result["status"] == "ok" && result["updated"] != 0);
+    }else if (action == "delete"){
+        result = handle_delete(coll, filter, touched);
+        mutated = (result["status"] == "ok" && result["deleted"] != 0);
+    }else if (action == "createIndex"){
+        result = handle_create_index(coll, data);
+    }else if (action == "dropIndex"){
+        result = handle_drop_index(coll, data);
+    }else if (action == "reserveIds"){
+        result = handle_reserve_ids(coll, data);
+    }else if (action == "bulkLoad"){
+        result = handle_bulk_load(coll, data, options);
+    }else if (action == "export"){
+        result = handle_export(coll, options);
+    }else if(action == "reset"){
+        if (mutationListener) {
+            for (auto& [name, c] : collections) mutationListener(name, {});
+            for (auto& [name, ts] : series) mutationListener(name, {});
+            for (auto& [name, view] : views) mutationListener(name, {});
+        }
+        collections.clear();
+        series.clear();
+        views.clear();
+        for (auto& [name, gen] : generations) ++gen;
+        if (queryCache) queryCache->clear();
+        remove_collection_files();
+        result = {{"status","ok"},{"message","all cleared"}};
+    }else  result =  {{"status","error"},{"message","unknown action"}};
+
+    if (scanBudget.exhausted()) {
+        result = over_budget(scanBudget, action, std::move(result));
+        if (result.value("status", "") != "ok") mutated = false;
+    }
+
+    if(mutated){
+        bump_generation(coll);
+        collections[coll].dirty = true;
+        if (!callWrites) {
+            persist(coll);
+        } else if (std::find(callWrites->begin(), callWrites->end(), coll) == callWrites->end()) {
+            callWrites->push_back(coll);
+        }
+        if (mutationListener) mutationListener(coll, touched);
+    }
+    if (!callWrites) enforce_memory_budget();
+
+    return result;
+    
+}
+
+// ---- stored procedures ----
+
+void Database::load_plugin(const std::string& path) {
+    struct Registry : ProcedureRegistry {
+        std::unordered_map<std::string, Procedure> added;
+        void add(const std::string& name, Procedure fn) override { added[name] = fn; }
+    } registry;
+    ::load_plugin(path, registry);
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    for (auto& [name, fn] : registry.added) procedures[name] = fn;
+    std::cout << "[DB] Loaded " << registry.added.size() << " procedures from " << path << "\n";
+}
+
+// Runs a procedure's operations through apply() and keeps an undo log of
+// them: the ids it created and the prior version of everything it updated
+// or deleted. Rolling back replays the log backwards. While it runs,
+// apply() leaves files and eviction alone; finish() writes the collections
+// the call touched once it has committed or rolled back.
+class Database::CallContext : public ProcedureContext {
+public:
+    CallContext(Database& db, const std::atomic<bool>* killed) : db(db), killed(killed) {
+        db.callWrites = &written;
+    }
+    ~CallContext() { db.callWrites = nullptr; }
+
+    json read(const std::string& coll, const json& filter) override {
+        return run("read", coll, filter, json::object(), json::object());
+    }
+    json query(const std::string& coll, const json& filter, const json& options) override {
+        return run("query", coll, filter, json::object(), options);
+    }
+    json create(const std::string& coll, const json& data) override {
+        json r = run("create", coll, json::object(), data, json::object());
+        if (r.value("status", "") == "ok") undo.push_back({coll, r["data"]["id"].get<int>(), nullptr});
+        return r;
+    }
+    json update(const std::string& coll, const json& filter, const json& data) override {
+        return write("update", coll, filter, data);
+    }
+    json del(const std::string& coll, const json& filter) override {
+        return write("delete", coll, filter, json::object());
+    }
+
+    // Restores each document directly rather than through apply(), so no
+    // scan budget or query limit can leave a step undone.
+    void rollback() {
+        for (auto it = undo.rbegin(); it != undo.rend(); ++it) db.restore_doc(it->coll, it->id, it->before);
+        undo.clear();
+    }
+
+    void finish() {
+        db.callWrites = nullptr;
+        for (const auto& coll : written) db.persist(coll);
+        db.enforce_memory_budget();
+    }
+
+private:
+    struct Undo {
+        std::string coll;
+        int id;
+        DocPtr before;      // null: the procedure created the document
+    };
+    Database& db;
+    const std::atomic<bool>* killed;
+    std::vector<Undo> undo;
+    std::vector<std::string> written;
+
+    json run(const std::string& action, const std::string& coll, const json& filter,
+             const json& data, const json& options) {
+        if (db.series.count(coll) || db.views.count(coll))
+            return {{"status","error"},{"message","procedures work on document collections only"}};
+        return db.apply(action, coll, filter, data, options, killed);
+    }
+
+    json write(const std::string& action, const std::string& coll, const json& filter, const json& data) {
+        std::vector<DocPtr> before = db.series.count(coll) || db.views.count(coll)
+                                         ? std::vector<DocPtr>() : db.find_docs(coll, filter, 0);
+        json r = run(action, coll, filter, data, json::object());
+        if (r.value("status", "") == "ok") {
+            for (auto& doc : before) undo.push_back({coll, doc->value["id"].get<int>(), doc});
+        }
+        return r;
+    }
+};
+
+// Puts coll/id back to `before` (null: absent), keeping indexes, views and
+// lease holders in step. Only a rollback calls it, under the lock.
+void Database::restore_doc(const std::string& coll, int id, const DocPtr& before) {
+    InMemoryCollection& c = get_collection(coll);
+    DocPtr now = c.docs.erase(id);
+    if (!now && !before) return;
+    if (now) c.doc_removed(id, now->value);
+    if (before) {
+        c.docs.insert(id, before);
+        c.doc_added(id, before->value);
+    }
+    update_views(coll, now ? &now->value : nullptr, before ? &before->value : nullptr);
+    bump_generation(coll);
+    c.dirty = true;
+    if (callWrites && std::find(callWrites->begin(), callWrites->end(), coll) == callWrites->end())
+        callWrites->push_back(coll);
+    if (mutationListener) mutationListener(coll, {id});
+}
+
+json Database::handle_call(const json& req, const std::atomic<bool>* killed) {
+    std::string name = req.contains("procedure") && req["procedure"].is_string()
+                           ? req["procedure"].get<std::string>() : "";
+    auto it = procedures.find(name);
+    if (it == procedures.end())
+        return {{"status","error"},{"message","unknown procedure: " + name}};
+
+    CallContext ctx(*this, killed);
+    json result;
+    try {
+        result = it->second(ctx, req.value("data", json::object()));
+        if (!result.is_object()) result = {{"result", result}};
+        if (!result.contains("status")) result["status"] = "ok";
+    } catch (const std::exception& e) {
+        result = {{"status","error"},{"message",e.what()}};
+    }
+    if (result["status"] != "ok") ctx.rollback();
+    ctx.finish();
+    return result;
+}
+
+// Lookups by primary key in a resident collection only touch single shards
+// of its doc map, so they run under the shared lock and do not wait on each
+// other. Returns false if the exclusive path is needed instead.
+bool Database::shared_lookup(const std::string& coll, const std::vector<int>& ids,
+                             std::vector<DocPtr>& out) {
+    if (!valid_collection_name(coll)) return false;
+
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    if (series.count(coll) || views.count(coll)) return false;
+    auto it = collections.find(coll);
+    if (it == collections.end()) {
+        out.assign(ids.size(), nullptr);
+        return true;
+    }
+    InMemoryCollection& c = it->second;
+    if (!c.resident) return false;  // faulting in needs the exclusive lock
+    c.lastAccess = ++accessClock;
+
+    out.reserve(ids.size());
+    for (int id : ids) out.push_back(c.docs.get(id));
+    return true;
+}
+
+static bool id_filter(const json& filter, int& id) {
+    if (!filter.is_object() || filter.size() != 1) return false;
+    auto it = filter.find("id");
+    if (it == filter.end() || !it->is_number_integer()) return false;
+    id = it->get<int>();
+    return true;
+}
+
+bool Database::point_read(const std::string& coll, const json& filter, json& result) {
+    int id;
+    std::vector<DocPtr> docs;
+    if (!id_filter(filter, id) || !shared_lookup(coll, {id}, docs)) return false;
+    result = data_of(docs[0]);
+    return true;
+}
+
+bool Database::point_mget(const std::string& coll, const json& ids, json& result) {
+    std::vector<int> keys;
+    std::vector<DocPtr> docs;
+    if (!parse_ids(ids, keys) || !shared_lookup(coll, keys, docs)) return false;
+    result = items_of(docs);
+    return true;
+}
+
+// Serves read-by-id and mget requests through shared_lookup.
+bool Database::try_point_lookup(const json& req, std::vector<DocPtr>& docs) {
+    auto action = req.find("action");
+    auto coll = req.find("collection");
+    if (action == req.end() || coll == req.end() || !coll->is_string())
+        return false;
+
+    std::vector<int> ids;
+    if (*action == "read") {
+        auto filter = req.find("filter");
+        int id;
+        if (filter == req.end() || !id_filter(*filter, id)) return false;
+        ids.push_back(id);
+    } else if (*action == "mget") {
+        auto data = req.find("data");
+        if (data == req.end() || !parse_ids(*data, ids)) return false;
+    } else {
+        return false;
+    }
+    return shared_lookup(coll->get<std::string>(), ids, docs);
+}
+
+json Database::handle_request(const json& req) {
+    json control;
+    if (handle_op_control(req, control)) return control;
+
+    std::vector<DocPtr> docs;
+    if (try_point_lookup(req, docs))
+        return req["action"] == "read" ? read_result(docs[0], req.value("options", json::object()))
+                                       : items_of(docs);
+
+    OpScope op(*this, req);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return dispatch(req, op.killed());
+}
+
+json Database::create(const std::string& coll, const json& data) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("create", coll, json::object(), data, json::object());
+}
+
+json Database::read(const std::string& coll, const json& filter) {
+    json result;
+    if (point_read(coll, filter, result)) return result;
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("read", coll, filter, json::object(), json::object());
+}
+
+json Database::mget(const std::string& coll, const json& ids) {
+    json result;
+    if (point_mget(coll, ids, result)) return result;
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("mget", coll, json::object(), ids, json::object());
+}
+
+json Database::query(const std::string& coll, const json& filter, const json& options) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("query", coll, filter, json::object(), options);
+}
+
+json Database::update(const std::string& coll, const json& filter, const json& data) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("update", coll, filter, data, json::object());
+}
+
+json Database::del(const std::string& coll, const json& filter) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("delete", coll, filter, json::object(), json::object());
+}
+
+json Database::create_index(const std::string& coll, const json& spec) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("createIndex", coll, json::object(), spec, json::object());
+}
+
+json Database::create_time_series(const std::string& coll, const json& spec) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("createTimeSeries", coll, json::object(), spec, json::object());
+}
+
+json Database::create_view(const std::string& name, const json& spec) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("createView", name, json::object(), spec, json::object());
+}
+
+json Database::call(const std::string& procedure, const json& args) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return handle_call({{"procedure", procedure}, {"data", args}}, nullptr);
+}
+
+json Database::append(const std::string& coll, const json& records) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("append", coll, json::object(), records, json::object());
+}
+
+json Database::reserve_ids(const std::string& coll, int count) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return apply("reserveIds", coll, json::object(), {{"count", count}}, json::object());
+}
+
+std::string Database::handle_request_serialized(const json& req) {
+    json control;
+    if (handle_op_control(req, control)) return control.dump();
+
+    std::vector<DocPtr> docs;
+    if (try_point_lookup(req, docs))
+        return req["action"] == "read" ? render_read(docs[0], req.value("options", json::object()))
+                                       : render_items(docs);
+
+    OpScope op(*this, req);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+
+    std::string action = req.value("action", "");
+    bool readOnly = (action == "read" || action == "query")
+                    && req.contains("collection") && req["collection"].is_string()
+                    && valid_collection_name(req["collection"].get<std::string>());
+    if (action == "export" && req.contains("collection") && req["collection"].is_string()) {
+        std::string coll = req["collection"].get<std::string>();
+        std::vector<DocPtr> page;
+        json cursor;
+        if (valid_collection_name(coll) && !series.count(coll) && !views.count(coll)
+            && export_page(coll, req.value("options", json::object()), page, cursor)) {
+            enforce_memory_budget();
+            return render_items(page, "\"cursor\":" + cursor.dump() + ",");
+        }
+    }
+    if (!readOnly)
+        return dispatch(req, op.killed()).dump();
+
+    std::string coll = req["collection"].get<std::string>();
+    json filter = req.value("filter", json::object());
+    json options = req.value("options", json::object());
+
+    // filter/options are objects backed by std::map, so dump() is already a
+    // canonical (key-sorted) form.
+    // Revalidation needs neither the scan nor the cache.
+    // Joined queries depend on more than one generation and skip the cache.
+    bool joined = action == "query" && options.is_object() && options.contains("lookup");
+    if (action == "query" && !joined && !series.count(coll) && !views.count(coll)) {
+        std::string etag = collection_etag(coll);
+        if (if_none_match(options, etag)) return not_modified(etag).dump();
+    }
+    if (joined) return dispatch(req, op.killed()).dump();
+
+    std::string key;
+    uint64_t gen = 0;
+    std::string out;
+    if (queryCache) {
+        key = coll + '\0' + action + '\0' + filter.dump() + '\0' + options.dump();
+        gen = generations[coll];
+        if (queryCache->lookup(key, gen, out))
+            return out;
+    }
+
+    if (series.count(coll) || views.count(coll)) {
+        out = dispatch(req, op.killed()).dump();
+    } else {
+        ScanBudget scanBudget = make_budget(options, action, op.killed());
+        BudgetScope budgetScope(budget, scanBudget);
+        docs = find_docs(coll, filter, action == "read" ? 1 : query_limit(options));
+        if (scanBudget.exhausted()) {   // never cached
+            enforce_memory_budget();
+            json result = action == "read" ? data_of(docs.empty() ? nullptr : docs[0]) : items_of(docs);
+            return over_budget(scanBudget, action, std::move(result)).dump();
+        }
+        out = action == "read" ? render_read(docs.empty() ? nullptr : docs[0], options)
+                               : render_items(docs, etag_member(collection_etag(coll)));
+    }
+    enforce_memory_budget();    // find_docs may have faulted the collection in
+
+    if (queryCache) queryCache->store(key, gen, out);
+    return out;
+}
+
+void Database::import_legacy_file(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return;
+
+    json j;
+    in >> j;
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        if (!valid_collection_name(it.key())) continue;
+        InMemoryCollection c = collection_from_json(it.value(), 1);
+        c.dirty = true;
+        collections[it.key()] = std::move(c);
+    }
+    std::cout << "[DB] Imported legacy " << path << "\n";
+}
+
+void Database::open(const std::string& dir) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    dataDir = dir;
+    collections.clear();
+    series.clear();
+    views.clear();
+    fs::create_directories(dataDir);
+    load_series_files();
+
+    std::set<std::string> names;
+    for (auto& entry : fs::directory_iterator(dataDir)) {
+        auto ext = entry.path().extension();
+        if (entry.is_regular_file() && (ext == ".snap" || ext == ".json"))
+            names.insert(entry.path().stem().string());
+    }
+    std::vector<std::string> files(names.begin(), names.end());
+
+    if (files.empty() && series.empty()) {
+        import_legacy_file("db.json");
+        flush();
+        load_view_files();
+        return;
+    }
+
+    // Parse collection files in parallel; each worker takes every
+    // nworkers-th file and writes only that file's slots, so no locking is
+    // needed. The flags are chars, not vector<bool>: neighbouring bits of
+    // one word would belong to different workers.
+    std::vector<InMemoryCollection> loaded(files.size());
+    std::vector<char> ok(files.size(), 0);
+    size_t nworkers = std::min<size_t>(files.size(),
+                                       std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nworkers; ++w) {
+        workers.emplace_back([&, w]() {
+            for (size_t i = w; i < files.size(); i += nworkers) {
+                try {
+                    InMemoryCollection& c = loaded[i];
+                    read_collection_file(dataDir, files[i],
+                        [&](const json& meta) {
+                            c.nextId = IdAllocator(meta.value("nextId", 1));
+                            add_indexes(c, meta.value("indexes", json::array()));
+                        },
+                        [&](json doc) { add_loaded_doc(c, std::move(doc)); });
+                    ok[i] = 1;
+                } catch (const std::exception& e) {
+                    std::cerr << "[DB] failed to load " << files[i] << ": " << e.what() << "\n";
+                }
+            }
+        });
+    }
+    for (auto& t : workers) t.join();
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!ok[i]) continue;
+        auto& c = collections[files[i]] = std::move(loaded[i]);
+        c.lastAccess = ++accessClock;
+    }
+    load_view_files();      // while every source is still resident
+    enforce_memory_budget();
+}
+
+// Encodes document by document instead of copying every document into
+// one json tree first.
+bool Database::save_collection(const std::string& name, const InMemoryCollection& c) {
+    std::vector<DocPtr> docs;
+    docs.reserve(c.docs.size());
+    c.docs.for_each([&](int, const DocPtr& doc) {
+        docs.push_back(doc);
+        return true;
+    });
+
+    std::string raw;
+    json::to_msgpack(json{{"count", docs.size()}, {"indexes", c.index_specs()},
+                          {"nextId", c.nextId.peek()}}, raw);
+    for (const auto& doc : docs) json::to_msgpack(doc->value, raw);
+
+    std::string body = file_header(kSnapMagic);
+    body += static_cast<char>(codec->id());
+    codec->compress(raw, body);
+    if (!write_file_atomically(fs::path(dataDir) / (name + ".snap"), body)) return false;
+
+    std::error_code ec;
+    fs::remove(fs::path(dataDir) / (name + ".json"), ec);   // superseded
+    return true;
+}
+
+// Appends records as one frame and syncs it; the existing contents are
+// never rewritten.
+bool Database::append_series_file(const std::string& name, const std::vector<json>& records) {
+    std::string body = log_frame(*codec, records);
+
+    fs::path path = fs::path(dataDir) / (name + ".tslog");
+    FILE* f = std::fopen(path.c_str(), "ab");
+    if (!f) {
+        std::cerr << "[DB] cannot append to " << path << "\n";
+        return false;
+    }
+    bool good = std::fwrite(body.data(), 1, body.size(), f) == body.size();
+    good = (std::fflush(f) == 0) && good;
+    good = (::fsync(fileno(f)) == 0) && good;
+    std::fclose(f);
+    if (!good) std::cerr << "[DB] short append to " << path << "\n";
+    return good;
+}
+
+// A torn last frame (crash mid-append) is cut off, so later appends
+// start on a frame boundary.
+static TimeSeries read_series_log(const fs::path& path, size_t& skipped) {
+    std::ifstream in(path, std::ios::binary);
+    if (!check_header(in, kLogMagic)) throw std::runtime_error("not a time series log");
+
+    std::optional<TimeSeries> ts;
+    std::string block;
+    std::streamoff goodEnd = in.tellg();
+    while (in.peek() != EOF) {
+        char h[5];
+        uint32_t n = 0;
+        if (in.read(h, sizeof(h))) {
+            for (int i = 0; i < 4; ++i) n |= uint32_t(static_cast<unsigned char>(h[1 + i])) << (8 * i);
+            block.resize(n);
+        }
+        if (!in || !in.read(&block[0], n)) {
+            std::cerr << "[DB] cutting a torn frame off " << path << "\n";
+            in.close();
+            fs::resize_file(path, goodEnd);
+            break;
+        }
+        goodEnd = in.tellg();
+
+        std::stringbuf src(block);
+        std::unique_ptr<std::streambuf> buf = codec_of(static_cast<uint8_t>(h[0])).decompressor(src);
+        std::istream raw(buf.get());
+        while (raw.peek() != EOF) {
+            json v = json::from_msgpack(raw, false);
+            if (!ts) {
+                ts = TimeSeries::from_spec(v.value("timeSeries", json::object()));
+            } else if (ts->valid_record(v)) {
+                ts->append(std::move(v));
+            } else {
+                ++skipped;
+            }
+        }
+    }
+    if (!ts) throw std::runtime_error("time series log has no spec");
+    return std::move(*ts);
+}
+
+// The text format of older releases: a spec line, then one record per
+// line. A torn last line fails to parse and is skipped.
+static TimeSeries read_legacy_series(const fs::path& path, size_t& skipped) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line)) throw std::runtime_error("empty time series file");
+    TimeSeries ts = TimeSeries::from_spec(json::parse(line).value("timeSeries", json::object()));
+    while (std::getline(in, line)) {
+        json r = json::parse(line, nullptr, false);
+        if (r.is_discarded() || !ts.valid_record(r)) {
+            ++skipped;
+            continue;
+        }
+        ts.append(std::move(r));
+    }
+    return ts;
+}
+
+void Database::load_series_files() {
+    for (auto& entry : fs::directory_iterator(dataDir)) {
+        auto ext = entry.path().extension();
+        if (!entry.is_regular_file() || (ext != ".tslog" && ext != ".series")) continue;
+        std::string name = entry.path().stem().string();
+        if (ext == ".series" && fs::exists(fs::path(dataDir) / (name + ".tslog"))) continue;
+        try {
+            size_t skipped = 0;
+            TimeSeries ts = ext == ".tslog" ? read_series_log(entry.path(), skipped)
+                                            : read_legacy_series(entry.path(), skipped);
+            if (skipped)
+                std::cerr << "[DB] skipped " << skipped << " bad records in " << entry.path() << "\n";
+            if (ext == ".series") convert_legacy_series(name, ts);
+            series.emplace(name, std::move(ts));
+        } catch (const std::exception& e) {
+            std::cerr << "[DB] failed to load " << entry.path() << ": " << e.what() << "\n";
+        }
+    }
+}
+
+void Database::convert_legacy_series(const std::string& name, const TimeSeries& ts) {
+    std::vector<json> records;
+    for (const json* r : ts.scan(json::object(), 0, false)) records.push_back(*r);
+    std::string body = file_header(kLogMagic) + log_frame(*codec, {json{{"timeSeries", ts.spec()}}});
+    if (!records.empty()) body += log_frame(*codec, records);
+    if (!write_file_atomically(fs::path(dataDir) / (name + ".tslog"), body)) return;
+    std::error_code ec;
+    fs::remove(fs::path(dataDir) / (name + ".series"), ec);
+}
+
+void Database::load_view_files() {
+    for (auto& entry : fs::directory_iterator(dataDir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".view") continue;
+        try {
+            std::ifstream in(entry.path());
+            MaterializedView view = MaterializedView::from_spec(json::parse(in));
+            build_view(view);
+            views.emplace(entry.path().stem().string(), std::move(view));
+        } catch (const std::exception& e) {
+            std::cerr << "[DB] failed to load " << entry.path() << ": " << e.what() << "\n";
+        }
+    }
+}
+
+// Writes coll after a committed change, with any other dirty collection.
+// flush() leaves a loading collection for the load to write; an ordinary
+// write to it still has to reach disk now.
+void Database::persist(const std::string& coll) {
+    auto& c = collections[coll];
+    if (c.dirty && c.bulkLoading && save_collection(coll, c)) c.dirty = false;
+    flush();
+}
+
+void Database::flush() {
+    for (auto& [name, coll] : collections) {
+        if (!coll.dirty || coll.bulkLoading) continue;
+        if (save_collection(name, coll)) coll.dirty = false;
+    }
+}
+
+void Database::remove_collection_files() {
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(dataDir, ec)) {
+        auto ext = entry.path().extension();
+        if (ext == ".snap" || ext == ".tslog" || ext == ".json" || ext == ".series"
+            || ext == ".view" || ext == ".tmp")
+            fs::remove(entry.path(), ec);
+    }
+}
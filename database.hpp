@@ -0,0 +1,270 @@
+#ifndef DATABASE_HPP
+#define DATABASE_HPP
+
+#include "json.hpp"
+#include "concurrent_doc_map.hpp"
+#include "materialized_view.hpp"
+#include "db_filter.hpp"
+#include "db_index.hpp"
+#include "db_plugin.hpp"
+#include "query_cache.hpp"
+#include "scan_budget.hpp"
+#include "scan_pool.hpp"
+#include "storage_codec.hpp"
+#include "time_series.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// LRU stamp that shared-lock readers may refresh concurrently. Moving it is
+// not atomic; collections are only moved under the exclusive lock.
+class AccessStamp {
+public:
+    AccessStamp() = default;
+    AccessStamp(AccessStamp&& other) noexcept : v(other.v.load(std::memory_order_relaxed)) {}
+    AccessStamp& operator=(AccessStamp&& other) noexcept {
+        v.store(other.v.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+    AccessStamp& operator=(uint64_t t) {
+        v.store(t, std::memory_order_relaxed);
+        return *this;
+    }
+    operator uint64_t() const { return v.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v{0};
+};
+
+class InMemoryCollection {
+public:
+    IdAllocator nextId;
+    ConcurrentDocMap docs;
+    std::vector<std::unique_ptr<SecondaryIndex>> indexes;
+    bool dirty = false;     // has changes not yet written to its file
+    // Set while a bulk load runs: index entries and the file are brought
+    // up to date once, when the load finishes (or its connection closes).
+    bool bulkLoading = false;
+
+    // Memory accounting. A non-resident collection has been spilled to its
+    // file (docs and index entries dropped) and is faulted back on access.
+    size_t bytes = 0;
+    bool resident = true;
+    size_t spilledDocs = 0;
+    AccessStamp lastAccess;
+
+    // Keep indexes and byte accounting in step with docs.
+    void doc_added(int id, const nlohmann::json& doc);
+    void doc_removed(int id, const nlohmann::json& doc);
+    nlohmann::json index_specs() const;
+};
+
+class Database {
+public:
+    nlohmann::json handle_request(const nlohmann::json& req);
+    // Same as handle_request, but returns the serialized response. Read,
+    // query and mget responses are assembled from each document's cached
+    // bytes (and read/query ones may come from the query cache), so they
+    // are sent without building or encoding a json tree.
+    std::string handle_request_serialized(const nlohmann::json& req);
+
+    // Typed entry points for in-process callers; same semantics and
+    // responses as the corresponding request actions.
+    nlohmann::json create(const std::string& coll, const nlohmann::json& data);
+    nlohmann::json read(const std::string& coll, const nlohmann::json& filter);
+    // Documents for an array of ids, in order, null where missing.
+    nlohmann::json mget(const std::string& coll, const nlohmann::json& ids);
+    nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                         const nlohmann::json& options = nlohmann::json::object());
+    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data);
+    nlohmann::json del(const std::string& coll, const nlohmann::json& filter);
+    nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec);
+    nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec);
+    nlohmann::json create_view(const std::string& name, const nlohmann::json& spec);
+    nlohmann::json append(const std::string& coll, const nlohmann::json& records);
+    nlohmann::json reserve_ids(const std::string& coll, int count);
+    nlohmann::json call(const std::string& procedure, const nlohmann::json& args);
+
+    void enable_query_cache(size_t maxEntries);
+
+    // Unindexed scans of large collections are split across this many
+    // threads (including the caller). 0 or 1 = scan on the calling thread.
+    void set_scan_threads(size_t threads);
+
+    // Approximate bytes of documents kept in RAM; when exceeded, the least
+    // recently used collections are spilled to disk. 0 = unlimited.
+    void set_memory_budget(size_t bytes);
+
+    // Scan limits for requests that do not set options.maxScan /
+    // options.maxTimeMs themselves. 0 = unlimited.
+    void set_query_limits(size_t maxScan, int maxTimeMs);
+
+    // Codec for data files written from now on ("zlib" by default, or
+    // "none"); files already on disk stay readable whatever their codec.
+    // Throws std::invalid_argument for an unknown name.
+    void set_storage_codec(const std::string& name);
+
+    // Called (under the database lock) after every committed mutation with
+    // the ids it touched; an empty list means the whole collection changed.
+    using MutationListener = std::function<void(const std::string& coll, const std::vector<int>& ids)>;
+    void set_mutation_listener(MutationListener listener);
+
+    // Registers the stored procedures of a plugin (see db_plugin.hpp) for
+    // the `call` action. Throws std::runtime_error if it cannot be loaded.
+    void load_plugin(const std::string& path);
+
+    // Each collection lives in a compressed snapshot, <dir>/<name>.snap,
+    // and each time series in an append-only log of compressed frames,
+    // <dir>/<name>.tslog (see database.cpp for the layout). A view only
+    // stores its spec, in <dir>/<name>.view; its rows are recomputed from
+    // the source.
+    // A legacy single-file db.json is imported on first open if the
+    // directory is empty.
+    void open(const std::string& dir);
+    void flush();   // rewrites only dirty collections
+
+private:
+    // Point reads by id take this shared; everything else takes it exclusive.
+    std::shared_mutex mtx;
+    std::string dataDir = "db";
+    std::unordered_map<std::string, InMemoryCollection> collections;
+    std::unordered_map<std::string, TimeSeries> series;     // always resident
+    std::unordered_map<std::string, MaterializedView> views; // rows rebuilt on open
+    std::unordered_map<std::string, uint64_t> generations; // bumped on every mutation
+    const uint64_t epoch = new_epoch();                     // part of every collection etag
+    std::unique_ptr<QueryCache> queryCache;
+    std::unique_ptr<ScanPool> scanPool;
+    MutationListener mutationListener;
+    const StorageCodec* codec = find_codec("zlib");
+    std::unordered_map<std::string, Procedure> procedures;
+
+    // Requests on the exclusive path, from arrival until they return.
+    // currentOp lists them and killOp flags one; both are served without
+    // taking mtx, so they work while a long scan holds it.
+    struct RunningOp {
+        std::string action;
+        std::string collection;
+        std::chrono::steady_clock::time_point start;
+        std::atomic<bool> killed{false};
+    };
+    class OpScope {
+    public:
+        OpScope(Database& db, const nlohmann::json& req);
+        ~OpScope();
+        const std::atomic<bool>* killed() const { return &op->killed; }
+
+    private:
+        Database& db;
+        uint64_t id;
+        std::shared_ptr<RunningOp> op;
+    };
+    std::mutex opsMtx;
+    std::map<uint64_t, std::shared_ptr<RunningOp>> ops;
+    uint64_t nextOpId = 1;
+
+    size_t defaultMaxScan = 0;
+    int defaultMaxTimeMs = 0;
+    ScanBudget* budget = nullptr;   // of the request holding mtx exclusively
+    // Set while a procedure runs: the collections it has written so far,
+    // persisted when it commits or rolls back rather than per write.
+    std::vector<std::string>* callWrites = nullptr;
+
+    size_t memoryBudget = 0;
+    std::atomic<uint64_t> accessClock{0};
+    uint64_t evictions = 0;
+    uint64_t faults = 0;
+    uint64_t faultMicrosTotal = 0;
+    uint64_t faultMicrosMax = 0;
+
+    InMemoryCollection* find_collection(const std::string& coll);
+    InMemoryCollection& get_collection(const std::string& coll);
+    void fault_in(const std::string& name, InMemoryCollection& c);
+    void enforce_memory_budget();
+
+    bool shared_lookup(const std::string& coll, const std::vector<int>& ids, std::vector<DocPtr>& out);
+    bool try_point_lookup(const nlohmann::json& req, std::vector<DocPtr>& docs);
+    bool point_read(const std::string& coll, const nlohmann::json& filter, nlohmann::json& result);
+    bool point_mget(const std::string& coll, const nlohmann::json& ids, nlohmann::json& result);
+
+    bool handle_op_control(const nlohmann::json& req, nlohmann::json& result);
+    ScanBudget make_budget(const nlohmann::json& options, const std::string& action,
+                           const std::atomic<bool>* killed) const;
+
+    nlohmann::json dispatch(const nlohmann::json& req, const std::atomic<bool>* killed = nullptr);
+    nlohmann::json apply(const std::string& action, const std::string& coll,
+                         const nlohmann::json& filter, const nlohmann::json& data,
+                         const nlohmann::json& options, const std::atomic<bool>* killed = nullptr);
+    nlohmann::json handle_stats();
+    class CallContext;
+    nlohmann::json handle_call(const nlohmann::json& req, const std::atomic<bool>* killed);
+    void restore_doc(const std::string& coll, int id, const DocPtr& before);
+    void bump_generation(const std::string& coll);
+    static uint64_t new_epoch();
+    std::string collection_etag(const std::string& coll);
+
+    void import_legacy_file(const std::string& path);
+    bool save_collection(const std::string& name, const InMemoryCollection& c);
+    void persist(const std::string& coll);
+    void load_series_files();
+    void convert_legacy_series(const std::string& name, const TimeSeries& ts);
+    void load_view_files();
+    bool append_series_file(const std::string& name, const std::vector<nlohmann::json>& records);
+    void remove_collection_files();
+
+    nlohmann::json handle_create(const std::string& coll, const nlohmann::json& data);
+    std::vector<DocPtr> find_docs(const std::string& coll, const nlohmann::json& filter, size_t limit);
+    nlohmann::json handle_read(const std::string& coll, const nlohmann::json& filter,
+                               const nlohmann::json& options);
+    nlohmann::json handle_mget(const std::string& coll, const nlohmann::json& ids);
+    nlohmann::json handle_query(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& options);
+
+    struct LookupStage {
+        std::string from;
+        FieldPath localField;
+        std::string foreignField;
+        std::string as;
+    };
+    static bool parse_lookups(const nlohmann::json& options, std::vector<LookupStage>& out, std::string& err);
+    std::string query_etag(const std::string& coll, const std::vector<LookupStage>& lookups);
+    void join_lookup(nlohmann::json& items, const LookupStage& stage);
+    nlohmann::json handle_update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data,
+                                 std::vector<int>& touched);
+    nlohmann::json handle_delete(const std::string& coll, const nlohmann::json& filter,
+                                 std::vector<int>& touched);
+    nlohmann::json handle_create_index(const std::string& coll, const nlohmann::json& spec);
+    nlohmann::json handle_drop_index(const std::string& coll, const nlohmann::json& spec);
+    nlohmann::json handle_reserve_ids(const std::string& coll, const nlohmann::json& data);
+    nlohmann::json handle_bulk_load(const std::string& coll, const nlohmann::json& data,
+                                    const nlohmann::json& options);
+    nlohmann::json handle_export(const std::string& coll, const nlohmann::json& options);
+    bool export_page(const std::string& coll, const nlohmann::json& options,
+                     std::vector<DocPtr>& docs, nlohmann::json& cursor);
+
+    nlohmann::json handle_create_time_series(const std::string& coll, const nlohmann::json& spec);
+    nlohmann::json handle_create_view(const std::string& name, const nlohmann::json& spec);
+    nlohmann::json handle_drop_view(const std::string& name);
+    nlohmann::json apply_view(const std::string& action, const std::string& name, const MaterializedView& view,
+                              const nlohmann::json& filter, const nlohmann::json& options);
+    void build_view(MaterializedView& view);
+    // Feeds one source change to every view over coll.
+    void update_views(const std::string& coll, const nlohmann::json* before, const nlohmann::json* after);
+    nlohmann::json apply_time_series(const std::string& action, const std::string& coll, TimeSeries& ts,
+                                     const nlohmann::json& filter, const nlohmann::json& data,
+                                     const nlohmann::json& options);
+
+    bool plan_candidates(InMemoryCollection& c, const nlohmann::json& filter, size_t limit,
+                         std::vector<int>& ids);
+    void for_each_match(InMemoryCollection& c, const nlohmann::json& filter, size_t limit,
+                        const std::function<void(int, const DocPtr&)>& fn);
+    void parallel_scan(InMemoryCollection& c, const Predicate& pred,
+                       std::vector<std::pair<int, DocPtr>>& matches);
+};
+
+#endif
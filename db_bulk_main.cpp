@@ -0,0 +1,187 @@
+#include "db_client.hpp"
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+using namespace std;
+using nlohmann::json;
+
+// Bulk import/export for one collection of a running db_server:
+//   db_bulk [--host H] [--port P] [--format ndjson|msgpack] import COLL FILE
+//   db_bulk [--host H] [--port P] [--format ndjson|msgpack] export COLL FILE
+// FILE "-" is stdin/stdout. NDJSON is one document per line; msgpack is a
+// plain concatenation of encoded documents.
+
+// Serialized documents per bulkLoad request, under the 64 KiB frame limit
+// with room for the envelope.
+static constexpr size_t kBatchBytes = 60 * 1024;
+// bulkLoad requests in flight at once on the connection.
+static constexpr size_t kPipelineDepth = 4;
+
+static int usage() {
+    cerr << "usage: db_bulk [--host H] [--port P] [--format ndjson|msgpack] "
+            "(import | export) COLLECTION FILE\n";
+    return 2;
+}
+
+// Reads the next document; false at end of input.
+static bool read_doc(istream& in, bool msgpack, json& doc) {
+    if (msgpack) {
+        if (in.peek() == EOF) return false;
+        doc = json::from_msgpack(in, false);
+        return true;
+    }
+    string line;
+    while (getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        doc = json::parse(line);
+        return true;
+    }
+    return false;
+}
+
+static void write_doc(ostream& out, bool msgpack, const json& doc) {
+    if (msgpack) {
+        vector<uint8_t> bytes = json::to_msgpack(doc);
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    } else {
+        out << doc.dump() << '\n';
+    }
+}
+
+static void check(const json& resp) {
+    if (resp.value("status", "") != "ok")
+        throw runtime_error(resp.value("message", resp.dump()));
+}
+
+static int run_import(DbClient& db, const string& coll, istream& in, bool msgpack) {
+    size_t loaded = 0;
+    size_t skipped = 0;
+    deque<future<json>> inflight;
+    auto settle = [&](future<json> f) {
+        json r = f.get();
+        check(r);
+        loaded += r.value("loaded", 0);
+        skipped += r.value("skipped", 0);
+    };
+    auto send = [&](json batch, bool done) {
+        json req = {{"action","bulkLoad"},{"collection",coll},{"data",std::move(batch)}};
+        if (done) req["options"] = {{"done", true}};
+        inflight.push_back(db.send_async(std::move(req)));
+    };
+
+    bool started = false;
+    try {
+        json batch = json::array();
+        size_t batchBytes = 0;
+        json doc;
+        while (read_doc(in, msgpack, doc)) {
+            size_t n = doc.dump().size() + 1;
+            if (n > kBatchBytes) throw runtime_error("document larger than a request: " + doc.dump().substr(0, 80));
+            if (batchBytes + n > kBatchBytes) {
+                send(std::move(batch), false);
+                started = true;
+                batch = json::array();
+                batchBytes = 0;
+                if (inflight.size() >= kPipelineDepth) {
+                    settle(std::move(inflight.front()));
+                    inflight.pop_front();
+                }
+            }
+            batch.push_back(std::move(doc));
+            batchBytes += n;
+        }
+
+        // The last batch finishes the load, so it goes after every other one.
+        while (!inflight.empty()) {
+            settle(std::move(inflight.front()));
+            inflight.pop_front();
+        }
+        started = false;
+        send(std::move(batch), true);
+        settle(std::move(inflight.front()));
+    } catch (...) {
+        // End the load with what the server already has, so the collection
+        // is indexed and written back; the error is reported either way.
+        if (started) {
+            try {
+                for (auto& f : inflight) f.wait();
+                db.send_async({{"action","bulkLoad"},{"collection",coll},{"data",json::array()},
+                               {"options",{{"done",true}}}}).get();
+                cerr << "[DB bulk] import stopped; " << coll << " keeps the documents loaded so far\n";
+            } catch (const std::exception&) {}    // the server ends it when we disconnect
+        }
+        throw;
+    }
+
+    cerr << "[DB bulk] loaded " << loaded << " documents into " << coll;
+    if (skipped) cerr << " (" << skipped << " skipped)";
+    cerr << "\n";
+    return 0;
+}
+
+static int run_export(DbClient& db, const string& coll, ostream& out, bool msgpack) {
+    size_t written = 0;
+    json cursor;
+    do {
+        json req = {{"action","export"},{"collection",coll},{"options",{{"cursor",cursor}}}};
+        json r = db.send_async(std::move(req)).get();
+        check(r);
+        for (const auto& doc : r["items"]) write_doc(out, msgpack, doc);
+        written += r["items"].size();
+        cursor = r["cursor"];
+    } while (!cursor.is_null());
+    out.flush();
+    if (!out) throw runtime_error("write failed");
+
+    cerr << "[DB bulk] exported " << written << " documents from " << coll << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    string host = "127.0.0.1";
+    uint16_t port = 12000;
+    string format = "ndjson";
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string k = argv[i];
+        if (k == "--host" && i + 1 < argc) host = argv[++i];
+        else if (k == "--port" && i + 1 < argc) port = static_cast<uint16_t>(stoi(argv[++i]));
+        else if (k == "--format" && i + 1 < argc) format = argv[++i];
+        else args.push_back(k);
+    }
+    if (args.size() != 3 || (format != "ndjson" && format != "msgpack")) return usage();
+    bool msgpack = format == "msgpack";
+    const string& cmd = args[0];
+    const string& coll = args[1];
+    const string& path = args[2];
+
+    try {
+        DbClient db(host, port);
+        auto start = chrono::steady_clock::now();
+        int rc;
+        if (cmd == "import") {
+            ifstream file;
+            if (path != "-") {
+                file.open(path, ios::binary);
+                if (!file) throw runtime_error("cannot open " + path);
+            }
+            rc = run_import(db, coll, path == "-" ? cin : file, msgpack);
+        } else if (cmd == "export") {
+            ofstream file;
+            if (path != "-") {
+                file.open(path, ios::binary | ios::trunc);
+                if (!file) throw runtime_error("cannot open " + path);
+            }
+            rc = run_export(db, coll, path == "-" ? cout : file, msgpack);
+        } else {
+            return usage();
+        }
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        cerr << "[DB bulk] " << ms << " ms\n";
+        return rc;
+    } catch (const std::exception& e) {
+        cerr << "[DB bulk] " << e.what() << "\n";
+        return 1;
+    }
+}
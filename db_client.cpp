@@ -1,61 +1,324 @@
 #include "db_client.hpp"
+#include <iostream>
 #include <stdexcept>
 
 using nlohmann::json;
 
-DbClient::DbClient(const std::string& host, uint16_t port) {
-    sock.connect_to(host, port);
+// ---- DbBackend async defaults ----
+
+std::future<json> DbBackend::submit(Op op) {
+    std::promise<json> p;
+    try {
+        p.set_value(op(*this));
+    } catch (...) {
+        p.set_exception(std::current_exception());
+    }
+    return p.get_future();
 }
 
-json DbClient::create(const std::string& coll, const json& data) {
-    json req = {
+void DbBackend::submit(Op op, Callback cb) {
+    json result;
+    try {
+        result = op(*this);
+    } catch (const std::exception& e) {
+        result = {{"status","error"},{"message",e.what()}};
+    }
+    cb(std::move(result));
+}
+
+std::future<json> DbBackend::create_async(const std::string& coll, const json& data) {
+    return submit([=](DbBackend& b) { return b.create(coll, data); });
+}
+
+std::future<json> DbBackend::read_async(const std::string& coll, const json& filter) {
+    return submit([=](DbBackend& b) { return b.read(coll, filter); });
+}
+
+std::future<json> DbBackend::query_async(const std::string& coll, const json& filter, const json& options) {
+    return submit([=](DbBackend& b) { return b.query(coll, filter, options); });
+}
+
+std::future<json> DbBackend::update_async(const std::string& coll, const json& filter, const json& data) {
+    return submit([=](DbBackend& b) { return b.update(coll, filter, data); });
+}
+
+std::future<json> DbBackend::del_async(const std::string& coll, const json& filter) {
+    return submit([=](DbBackend& b) { return b.del(coll, filter); });
+}
+
+void DbBackend::create_async(const std::string& coll, const json& data, Callback cb) {
+    submit([=](DbBackend& b) { return b.create(coll, data); }, std::move(cb));
+}
+
+void DbBackend::read_async(const std::string& coll, const json& filter, Callback cb) {
+    submit([=](DbBackend& b) { return b.read(coll, filter); }, std::move(cb));
+}
+
+void DbBackend::query_async(const std::string& coll, const json& filter, const json& options, Callback cb) {
+    submit([=](DbBackend& b) { return b.query(coll, filter, options); }, std::move(cb));
+}
+
+void DbBackend::update_async(const std::string& coll, const json& filter, const json& data, Callback cb) {
+    submit([=](DbBackend& b) { return b.update(coll, filter, data); }, std::move(cb));
+}
+
+void DbBackend::del_async(const std::string& coll, const json& filter, Callback cb) {
+    submit([=](DbBackend& b) { return b.del(coll, filter); }, std::move(cb));
+}
+
+// ---- DbClient ----
+
+static json create_req(const std::string& coll, const json& data) {
+    return {
         {"collection", coll},
         {"action", "create"},
         {"data", data}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
 }
 
-json DbClient::read(const std::string& coll, const json& filter) {
-    json req = {
+static json read_req(const std::string& coll, const json& filter) {
+    return {
         {"collection", coll},
         {"action", "read"},
         {"filter", filter}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
 }
 
-json DbClient::query(const std::string& coll, const json& filter) {
+static json query_req(const std::string& coll, const json& filter, const json& options) {
     json req = {
         {"collection", coll},
         {"action", "query"},
         {"filter", filter}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
+    if (!options.empty()) req["options"] = options;
+    return req;
 }
 
-json DbClient::update(const std::string& coll, const json& filter, const json& data) {
-    json req = {
+static json update_req(const std::string& coll, const json& filter, const json& data) {
+    return {
         {"collection", coll},
         {"action", "update"},
         {"filter", filter},
         {"data", data}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
 }
 
-json DbClient::del(const std::string& coll, const json& filter) {
-    json req = {
+static json del_req(const std::string& coll, const json& filter) {
+    return {
         {"collection", coll},
         {"action", "delete"},
         {"filter", filter}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
+}
+
+DbClient::DbClient(const std::string& host, uint16_t port) {
+    sock.connect_to(host, port);
+    sock.set_nodelay();
+    reader = std::thread(&DbClient::reader_loop, this);
+}
+
+DbClient::~DbClient() {
+    sock.shutdown();
+    if (reader.joinable()) reader.join();
+}
+
+// Callbacks run on the reader thread; one that throws is logged rather
+// than allowed to end the thread and fail every other pending request.
+static void run_callback(const DbBackend::Callback& cb, json result) {
+    try {
+        cb(std::move(result));
+    } catch (const std::exception& e) {
+        std::cerr << "[DB client] callback failed: " << e.what() << "\n";
+    } catch (...) {
+        std::cerr << "[DB client] callback failed\n";
+    }
+}
+
+void DbClient::reader_loop() {
+    try {
+        while (true) {
+            json resp = recv_json(sock.fd());
+            if (resp.value("event", "") == "invalidate") {
+                if (nearCache) {
+                    nearCache->invalidate(resp.value("collection", ""),
+                                          resp.value("ids", std::vector<int>{}));
+                }
+                continue;
+            }
+            if (!resp.contains("reqId") || !resp["reqId"].is_number_unsigned())
+                continue;   // not a reply to anything we sent
+            uint64_t id = resp["reqId"].get<uint64_t>();
+            resp.erase("reqId");
+
+            Pending p;
+            {
+                std::lock_guard<std::mutex> lock(pendingMtx);
+                auto it = pending.find(id);
+                if (it == pending.end()) continue;
+                p = std::move(it->second);
+                pending.erase(it);
+            }
+            if (p.hook) p.hook(resp);
+            if (p.cb) run_callback(p.cb, std::move(resp));
+            else p.promise.set_value(std::move(resp));
+        }
+    } catch (const std::exception& e) {
+        fail_pending(e.what());
+    }
+}
+
+void DbClient::fail_pending(const std::string& why) {
+    std::unordered_map<uint64_t, Pending> failed;
+    {
+        std::lock_guard<std::mutex> lock(pendingMtx);
+        alive = false;
+        failed.swap(pending);
+    }
+    for (auto& [id, p] : failed) {
+        if (p.cb) {
+            run_callback(p.cb, {{"status","error"},{"message",why}});
+        } else {
+            p.promise.set_exception(std::make_exception_ptr(std::runtime_error(why)));
+        }
+    }
+}
+
+uint64_t DbClient::start_request(json& req, Pending p) {
+    std::lock_guard<std::mutex> lock(pendingMtx);
+    if (!alive) throw std::runtime_error("db connection closed");
+    uint64_t id = nextReqId++;
+    req["reqId"] = id;
+    pending.emplace(id, std::move(p));
+    return id;
+}
+
+void DbClient::write_request(uint64_t id, const json& req) {
+    try {
+        std::lock_guard<std::mutex> lock(sendMtx);
+        send_json(sock.fd(), req);
+    } catch (...) {
+        size_t erased;
+        {
+            std::lock_guard<std::mutex> lock(pendingMtx);
+            erased = pending.erase(id);
+        }
+        // The frame may be half written; the connection is unusable.
+        sock.shutdown();
+        if (erased) throw;
+        // otherwise the reader thread already failed this request
+    }
+}
+
+std::future<json> DbClient::send_async(json req) {
+    return send_hooked(std::move(req), nullptr);
+}
+
+void DbClient::send_async(json req, Callback cb) {
+    send_hooked(std::move(req), nullptr, std::move(cb));
+}
+
+std::future<json> DbClient::send_hooked(json req, Hook hook) {
+    Pending p;
+    p.hook = std::move(hook);
+    std::future<json> f = p.promise.get_future();
+    uint64_t id = start_request(req, std::move(p));
+    write_request(id, req);
+    return f;
+}
+
+void DbClient::send_hooked(json req, Hook hook, Callback cb) {
+    Pending p;
+    p.hook = std::move(hook);
+    p.cb = cb;
+    uint64_t id;
+    try {
+        id = start_request(req, std::move(p));
+        write_request(id, req);
+    } catch (const std::exception& e) {
+        cb({{"status","error"},{"message",e.what()}});
+    }
+}
+
+bool DbClient::connected() {
+    std::lock_guard<std::mutex> lock(pendingMtx);
+    return alive;
+}
+
+// ---- near cache ----
+
+void DbClient::set_near_cache(std::shared_ptr<NearCache> cache) {
+    nearCache = std::move(cache);
+}
+
+json DbClient::leased_read_req(const std::string& coll, const json& filter) {
+    json req = read_req(coll, filter);
+    if (nearCache) req["lease"] = true;
+    return req;
+}
+
+DbClient::Hook DbClient::read_hook(const std::string& coll, const json& filter) {
+    if (!nearCache) return nullptr;
+    // Expiry counts from the send time, so our copy never outlives the
+    // server's lease.
+    auto sent = NearCache::Clock::now();
+    uint64_t epoch = nearCache->epoch(coll);
+    std::shared_ptr<NearCache> cache = nearCache;
+    return [cache, coll, filter, sent, epoch](json& resp) {
+        if (!resp.contains("leaseMs")) return;
+        int ms = resp["leaseMs"].get<int>();
+        resp.erase("leaseMs");
+        if (resp.value("status", "") == "ok" && resp.contains("data"))
+            cache->put(coll, filter, resp["data"], sent + std::chrono::milliseconds(ms), epoch);
+    };
+}
+
+// Our own writes drop cached copies as soon as they are acknowledged, so a
+// caller always reads its own writes even if the server's invalidation for
+// another pooled connection is still in flight.
+DbClient::Hook DbClient::write_hook(const std::string& coll, const json& filter) {
+    if (!nearCache) return nullptr;
+    std::shared_ptr<NearCache> cache = nearCache;
+    bool byId = filter.is_object() && filter.size() == 1
+                && filter.contains("id") && filter["id"].is_number_integer();
+    int id = byId ? filter["id"].get<int>() : 0;
+    return [cache, coll, byId, id](json& resp) {
+        std::vector<int> ids;
+        if (byId) ids.push_back(id);
+        else if (resp.contains("data") && resp["data"].contains("id")) ids.push_back(resp["data"]["id"].get<int>());
+        cache->invalidate(coll, ids);
+    };
+}
+
+json DbClient::create(const std::string& coll, const json& data) {
+    return send_hooked(create_req(coll, data), write_hook(coll, json::object())).get();
+}
+
+json DbClient::read(const std::string& coll, const json& filter) {
+    json cached;
+    if (nearCache && nearCache->get(coll, filter, cached))
+        return {{"status","ok"},{"data",cached}};
+    return send_hooked(leased_read_req(coll, filter), read_hook(coll, filter)).get();
+}
+
+json DbClient::mget(const std::string& coll, const json& ids) {
+    json req = {
+        {"collection", coll},
+        {"action", "mget"},
+        {"data", ids}
+    };
+    return send_async(req).get();
+}
+
+json DbClient::query(const std::string& coll, const json& filter, const json& options) {
+    return send_async(query_req(coll, filter, options)).get();
+}
+
+json DbClient::update(const std::string& coll, const json& filter, const json& data) {
+    return send_hooked(update_req(coll, filter, data), write_hook(coll, filter)).get();
+}
+
+json DbClient::del(const std::string& coll, const json& filter) {
+    return send_hooked(del_req(coll, filter), write_hook(coll, filter)).get();
 }
 
 json DbClient::reset(const std::string& coll, const json& filter) {
@@ -64,6 +327,110 @@ json DbClient::reset(const std::string& coll, const json& filter) {
         {"action", "reset"},
         {"filter", filter}
     };
-    send_json(sock.fd(), req);
-    return recv_json(sock.fd());
+    return send_async(req).get();
+}
+
+json DbClient::create_index(const std::string& coll, const json& spec) {
+    json req = {
+        {"collection", coll},
+        {"action", "createIndex"},
+        {"data", spec}
+    };
+    return send_async(req).get();
+}
+
+json DbClient::create_time_series(const std::string& coll, const json& spec) {
+    json req = {
+        {"collection", coll},
+        {"action", "createTimeSeries"},
+        {"data", spec}
+    };
+    return send_async(req).get();
+}
+
+json DbClient::create_view(const std::string& name, const json& spec) {
+    json req = {
+        {"collection", name},
+        {"action", "createView"},
+        {"data", spec}
+    };
+    return send_async(req).get();
+}
+
+json DbClient::call(const std::string& procedure, const json& args) {
+    json req = {
+        {"action", "call"},
+        {"procedure", procedure},
+        {"data", args}
+    };
+    return send_async(req).get();
+}
+
+json DbClient::append(const std::string& coll, const json& records) {
+    json req = {
+        {"collection", coll},
+        {"action", "append"},
+        {"data", records}
+    };
+    return send_hooked(req, write_hook(coll, json::object())).get();
+}
+
+json DbClient::reserve_ids(const std::string& coll, int count) {
+    json req = {
+        {"collection", coll},
+        {"action", "reserveIds"},
+        {"data", {{"count", count}}}
+    };
+    return send_async(req).get();
+}
+
+std::future<json> DbClient::create_async(const std::string& coll, const json& data) {
+    return send_hooked(create_req(coll, data), write_hook(coll, json::object()));
+}
+
+std::future<json> DbClient::read_async(const std::string& coll, const json& filter) {
+    json cached;
+    if (nearCache && nearCache->get(coll, filter, cached)) {
+        std::promise<json> p;
+        p.set_value({{"status","ok"},{"data",cached}});
+        return p.get_future();
+    }
+    return send_hooked(leased_read_req(coll, filter), read_hook(coll, filter));
+}
+
+std::future<json> DbClient::query_async(const std::string& coll, const json& filter, const json& options) {
+    return send_async(query_req(coll, filter, options));
+}
+
+std::future<json> DbClient::update_async(const std::string& coll, const json& filter, const json& data) {
+    return send_hooked(update_req(coll, filter, data), write_hook(coll, filter));
+}
+
+std::future<json> DbClient::del_async(const std::string& coll, const json& filter) {
+    return send_hooked(del_req(coll, filter), write_hook(coll, filter));
+}
+
+void DbClient::create_async(const std::string& coll, const json& data, Callback cb) {
+    send_hooked(create_req(coll, data), write_hook(coll, json::object()), std::move(cb));
+}
+
+void DbClient::read_async(const std::string& coll, const json& filter, Callback cb) {
+    json cached;
+    if (nearCache && nearCache->get(coll, filter, cached)) {
+        cb({{"status","ok"},{"data",cached}});
+        return;
+    }
+    send_hooked(leased_read_req(coll, filter), read_hook(coll, filter), std::move(cb));
+}
+
+void DbClient::query_async(const std::string& coll, const json& filter, const json& options, Callback cb) {
+    send_async(query_req(coll, filter, options), std::move(cb));
+}
+
+void DbClient::update_async(const std::string& coll, const json& filter, const json& data, Callback cb) {
+    send_hooked(update_req(coll, filter, data), write_hook(coll, filter), std::move(cb));
+}
+
+void DbClient::del_async(const std::string& coll, const json& filter, Callback cb) {
+    send_hooked(del_req(coll, filter), write_hook(coll, filter), std::move(cb));
 }
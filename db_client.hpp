@@ -3,21 +3,158 @@
 
 #include "protocol.hpp"
 #include "json.hpp"
+#include "near_cache.hpp"
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
-class DbClient {
+// Interface the lobby talks to; implemented over TCP (DbClient) or by an
+// in-process Database (EmbeddedDbClient).
+class DbBackend {
+public:
+    virtual ~DbBackend() = default;
+
+    virtual nlohmann::json create(const std::string& coll, const nlohmann::json& data) = 0;
+    virtual nlohmann::json read(const std::string& coll, const nlohmann::json& filter) = 0;
+    // One round trip for many primary keys: {"items":[doc or null, ...]}
+    // in the order of ids.
+    virtual nlohmann::json mget(const std::string& coll, const nlohmann::json& ids) = 0;
+    virtual nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                                 const nlohmann::json& options = nlohmann::json::object()) = 0;
+    virtual nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) = 0;
+    virtual nlohmann::json del(const std::string& coll, const nlohmann::json& filter) = 0;
+    virtual nlohmann::json reset(const std::string& coll, const nlohmann::json& filter) = 0;
+
+    // Idempotent: creating an index that already exists is a no-op.
+    virtual nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec) = 0;
+
+    // Time series: spec is {"timeField":..., "segmentSize":...}; creating
+    // one that exists is a no-op. append takes one record or an array.
+    virtual nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec) = 0;
+    virtual nlohmann::json append(const std::string& coll, const nlohmann::json& records) = 0;
+
+    // Materialized view: a group-by aggregate over a collection or time
+    // series, read like a collection. Creating one with the same spec is
+    // a no-op.
+    virtual nlohmann::json create_view(const std::string& name, const nlohmann::json& spec) = 0;
+
+    // Runs a stored procedure loaded into the server (see db_plugin.hpp).
+    virtual nlohmann::json call(const std::string& procedure, const nlohmann::json& args) = 0;
+
+    // Leases count consecutive ids from the collection's persistent
+    // sequence: {"first":..., "count":...}.
+    virtual nlohmann::json reserve_ids(const std::string& coll, int count) = 0;
+
+    // Asynchronous variants. The defaults run the call inline through
+    // submit(); backends that can overlap requests override submit().
+    using Callback = std::function<void(nlohmann::json)>;
+    using Op = std::function<nlohmann::json(DbBackend&)>;
+
+    virtual std::future<nlohmann::json> create_async(const std::string& coll, const nlohmann::json& data);
+    virtual std::future<nlohmann::json> read_async(const std::string& coll, const nlohmann::json& filter);
+    virtual std::future<nlohmann::json> query_async(const std::string& coll, const nlohmann::json& filter,
+                                                    const nlohmann::json& options = nlohmann::json::object());
+    virtual std::future<nlohmann::json> update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data);
+    virtual std::future<nlohmann::json> del_async(const std::string& coll, const nlohmann::json& filter);
+
+    // Callback variants; the callback runs on whichever thread completes the
+    // request and receives {"status":"error",...} if the transport failed.
+    virtual void create_async(const std::string& coll, const nlohmann::json& data, Callback cb);
+    virtual void read_async(const std::string& coll, const nlohmann::json& filter, Callback cb);
+    virtual void query_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& options, Callback cb);
+    virtual void update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data, Callback cb);
+    virtual void del_async(const std::string& coll, const nlohmann::json& filter, Callback cb);
+
+    virtual std::future<nlohmann::json> submit(Op op);
+    virtual void submit(Op op, Callback cb);
+};
+
+// One TCP connection to db_server. Requests carry a client-assigned reqId
+// and a reader thread matches replies by id, so any number of requests may
+// be in flight at once and the client is safe to share between threads.
+class DbClient : public DbBackend {
 public:
     DbClient(const std::string& host, uint16_t port);
+    ~DbClient() override;
 
-    nlohmann::json create(const std::string& coll, const nlohmann::json& data);
-    nlohmann::json read(const std::string& coll, const nlohmann::json& filter);
-    nlohmann::json query(const std::string& coll, const nlohmann::json& filter);
-    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data);
-    nlohmann::json del(const std::string& coll, const nlohmann::json& filter);
-    nlohmann::json reset(const std::string& coll, const nlohmann::json& filter);
+    DbClient(const DbClient&) = delete;
+    DbClient& operator=(const DbClient&) = delete;
+
+    nlohmann::json create(const std::string& coll, const nlohmann::json& data) override;
+    nlohmann::json read(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json mget(const std::string& coll, const nlohmann::json& ids) override;
+    nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                         const nlohmann::json& options = nlohmann::json::object()) override;
+    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    nlohmann::json del(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json reset(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_view(const std::string& name, const nlohmann::json& spec) override;
+    nlohmann::json call(const std::string& procedure, const nlohmann::json& args) override;
+    nlohmann::json append(const std::string& coll, const nlohmann::json& records) override;
+    nlohmann::json reserve_ids(const std::string& coll, int count) override;
+
+    std::future<nlohmann::json> create_async(const std::string& coll, const nlohmann::json& data) override;
+    std::future<nlohmann::json> read_async(const std::string& coll, const nlohmann::json& filter) override;
+    std::future<nlohmann::json> query_async(const std::string& coll, const nlohmann::json& filter,
+                                            const nlohmann::json& options = nlohmann::json::object()) override;
+    std::future<nlohmann::json> update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    std::future<nlohmann::json> del_async(const std::string& coll, const nlohmann::json& filter) override;
+
+    // Callbacks run on the reader thread and must not block on this client.
+    void create_async(const std::string& coll, const nlohmann::json& data, Callback cb) override;
+    void read_async(const std::string& coll, const nlohmann::json& filter, Callback cb) override;
+    void query_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& options, Callback cb) override;
+    void update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data, Callback cb) override;
+    void del_async(const std::string& coll, const nlohmann::json& filter, Callback cb) override;
+
+    // Sends a raw request; reqId is filled in.
+    std::future<nlohmann::json> send_async(nlohmann::json req);
+    void send_async(nlohmann::json req, Callback cb);
+
+    bool connected();
+
+    // Opt-in client-side cache for read(); may be shared between clients.
+    // Must be set before the client is used from other threads.
+    void set_near_cache(std::shared_ptr<NearCache> cache);
 
 private:
+    // Runs on the reader thread when the reply arrives, before it is
+    // handed to the caller.
+    using Hook = std::function<void(nlohmann::json&)>;
+
+    struct Pending {
+        std::promise<nlohmann::json> promise;
+        Callback cb;            // used instead of promise when set
+        Hook hook;
+    };
+
     TcpSocket sock;
+    std::mutex sendMtx;         // one frame at a time on the socket
+
+    std::mutex pendingMtx;
+    std::unordered_map<uint64_t, Pending> pending;
+    uint64_t nextReqId = 1;
+    bool alive = true;
+
+    std::thread reader;
+    std::shared_ptr<NearCache> nearCache;
+
+    void reader_loop();
+    void fail_pending(const std::string& why);
+    uint64_t start_request(nlohmann::json& req, Pending p);
+    void write_request(uint64_t id, const nlohmann::json& req);
+    std::future<nlohmann::json> send_hooked(nlohmann::json req, Hook hook);
+    void send_hooked(nlohmann::json req, Hook hook, Callback cb);
+
+    nlohmann::json leased_read_req(const std::string& coll, const nlohmann::json& filter);
+    Hook read_hook(const std::string& coll, const nlohmann::json& filter);
+    Hook write_hook(const std::string& coll, const nlohmann::json& filter);
 };
 
 #endif 
@@ -0,0 +1,252 @@
+#include "db_client_pool.hpp"
+#include <iostream>
+#include <stdexcept>
+
+using nlohmann::json;
+
+// ---- Lease ----
+
+DbClientPool::Lease::Lease(DbClientPool& p, size_t s, std::shared_ptr<DbClient> c)
+    : pool(&p), slot(s), conn(std::move(c)) {}
+
+DbClientPool::Lease::Lease(Lease&& other) noexcept
+    : pool(other.pool), slot(other.slot), conn(std::move(other.conn)) {
+    other.pool = nullptr;
+}
+
+DbClientPool::Lease::~Lease() {
+    if (pool) pool->give_back(slot);
+}
+
+// ---- DbClientPool ----
+
+DbClientPool::DbClientPool(const std::string& h, uint16_t p, size_t size)
+    : host(h), port(p) {
+    if (size == 0) size = 1;
+    slots.resize(size);
+    for (auto& slot : slots) {
+        slot.conn = std::make_shared<DbClient>(host, port);
+    }
+    for (size_t i = 0; i < size; ++i) {
+        workers.emplace_back(&DbClientPool::worker_loop, this);
+    }
+}
+
+DbClientPool::~DbClientPool() {
+    {
+        std::lock_guard<std::mutex> lock(taskMtx);
+        stopping = true;
+    }
+    taskCv.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+// Called with mtx held. Reconnecting under the lock is rare (only after the
+// DB went away) and keeps two callers from racing to reopen one slot.
+std::shared_ptr<DbClient> DbClientPool::ensure_open(Slot& slot) {
+    if (!slot.conn || !slot.conn->connected()) {
+        slot.conn.reset();
+        slot.conn = std::make_shared<DbClient>(host, port);
+        if (nearCache) slot.conn->set_near_cache(nearCache);
+    }
+    return slot.conn;
+}
+
+// Existing connections are replaced rather than modified, since a
+// DbClient's cache must not change while other threads use it.
+void DbClientPool::enable_near_cache(size_t maxBytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    nearCache = maxBytes ? std::make_shared<NearCache>(maxBytes) : nullptr;
+    for (auto& slot : slots) {
+        slot.conn = std::make_shared<DbClient>(host, port);
+        if (nearCache) slot.conn->set_near_cache(nearCache);
+    }
+}
+
+json DbClientPool::near_cache_stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return nearCache ? nearCache->stats() : json(nullptr);
+}
+
+std::shared_ptr<DbClient> DbClientPool::pick() {
+    std::lock_guard<std::mutex> lock(mtx);
+    Slot& slot = slots[nextSlot];
+    nextSlot = (nextSlot + 1) % slots.size();
+    return ensure_open(slot);
+}
+
+DbClientPool::Lease DbClientPool::checkout() {
+    std::unique_lock<std::mutex> lock(mtx);
+    size_t idx = 0;
+    connCv.wait(lock, [&] {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (!slots[i].leased) { idx = i; return true; }
+        }
+        return false;
+    });
+    std::shared_ptr<DbClient> conn = ensure_open(slots[idx]);
+    slots[idx].leased = true;
+    return Lease(*this, idx, std::move(conn));
+}
+
+void DbClientPool::give_back(size_t slot) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        slots[slot].leased = false;
+    }
+    connCv.notify_one();
+}
+
+json DbClientPool::run(const Op& op) {
+    Lease lease = checkout();
+    return op(*lease);
+}
+
+json DbClientPool::create(const std::string& coll, const json& data) {
+    return pick()->create(coll, data);
+}
+
+json DbClientPool::read(const std::string& coll, const json& filter) {
+    return pick()->read(coll, filter);
+}
+
+json DbClientPool::mget(const std::string& coll, const json& ids) {
+    return pick()->mget(coll, ids);
+}
+
+json DbClientPool::query(const std::string& coll, const json& filter, const json& options) {
+    return pick()->query(coll, filter, options);
+}
+
+json DbClientPool::update(const std::string& coll, const json& filter, const json& data) {
+    return pick()->update(coll, filter, data);
+}
+
+json DbClientPool::del(const std::string& coll, const json& filter) {
+    return pick()->del(coll, filter);
+}
+
+json DbClientPool::reset(const std::string& coll, const json& filter) {
+    return pick()->reset(coll, filter);
+}
+
+json DbClientPool::create_index(const std::string& coll, const json& spec) {
+    return pick()->create_index(coll, spec);
+}
+
+json DbClientPool::create_time_series(const std::string& coll, const json& spec) {
+    return pick()->create_time_series(coll, spec);
+}
+
+json DbClientPool::create_view(const std::string& name, const json& spec) {
+    return pick()->create_view(name, spec);
+}
+
+json DbClientPool::call(const std::string& procedure, const json& args) {
+    return pick()->call(procedure, args);
+}
+
+json DbClientPool::append(const std::string& coll, const json& records) {
+    return pick()->append(coll, records);
+}
+
+json DbClientPool::reserve_ids(const std::string& coll, int count) {
+    return pick()->reserve_ids(coll, count);
+}
+
+std::future<json> DbClientPool::create_async(const std::string& coll, const json& data) {
+    return pick()->create_async(coll, data);
+}
+
+std::future<json> DbClientPool::read_async(const std::string& coll, const json& filter) {
+    return pick()->read_async(coll, filter);
+}
+
+std::future<json> DbClientPool::query_async(const std::string& coll, const json& filter, const json& options) {
+    return pick()->query_async(coll, filter, options);
+}
+
+std::future<json> DbClientPool::update_async(const std::string& coll, const json& filter, const json& data) {
+    return pick()->update_async(coll, filter, data);
+}
+
+std::future<json> DbClientPool::del_async(const std::string& coll, const json& filter) {
+    return pick()->del_async(coll, filter);
+}
+
+void DbClientPool::create_async(const std::string& coll, const json& data, Callback cb) {
+    pick()->create_async(coll, data, std::move(cb));
+}
+
+void DbClientPool::read_async(const std::string& coll, const json& filter, Callback cb) {
+    pick()->read_async(coll, filter, std::move(cb));
+}
+
+void DbClientPool::query_async(const std::string& coll, const json& filter, const json& options, Callback cb) {
+    pick()->query_async(coll, filter, options, std::move(cb));
+}
+
+void DbClientPool::update_async(const std::string& coll, const json& filter, const json& data, Callback cb) {
+    pick()->update_async(coll, filter, data, std::move(cb));
+}
+
+void DbClientPool::del_async(const std::string& coll, const json& filter, Callback cb) {
+    pick()->del_async(coll, filter, std::move(cb));
+}
+
+// ---- async ----
+
+void DbClientPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(taskMtx);
+        tasks.push_back(std::move(task));
+    }
+    taskCv.notify_one();
+}
+
+void DbClientPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(taskMtx);
+            taskCv.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;      // stopping and drained
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+std::future<json> DbClientPool::submit(Op op) {
+    auto p = std::make_shared<std::promise<json>>();
+    std::future<json> f = p->get_future();
+    enqueue([this, p, op = std::move(op)]() {
+        try {
+            p->set_value(run(op));
+        } catch (...) {
+            p->set_exception(std::current_exception());
+        }
+    });
+    return f;
+}
+
+void DbClientPool::submit(Op op, Callback cb) {
+    enqueue([this, op = std::move(op), cb = std::move(cb)]() {
+        json result;
+        try {
+            result = run(op);
+        } catch (const std::exception& e) {
+            result = {{"status","error"},{"message",e.what()}};
+        }
+        // A throwing callback must not take the worker thread (and with
+        // it the process) down; there is no caller left to hand it to.
+        try {
+            cb(std::move(result));
+        } catch (const std::exception& e) {
+            std::cerr << "[DB pool] callback failed: " << e.what() << "\n";
+        } catch (...) {
+            std::cerr << "[DB pool] callback failed\n";
+        }
+    });
+}
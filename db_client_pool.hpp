@@ -0,0 +1,112 @@
+#ifndef DB_CLIENT_POOL_HPP
+#define DB_CLIENT_POOL_HPP
+
+#include "db_client.hpp"
+#include "json.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of DbClient connections that is safe to share between
+// threads. Since DbClient pipelines requests, typed calls are spread
+// round-robin over the connections without exclusive ownership. checkout()
+// still hands out a connection no other Lease holds, and submit() runs
+// arbitrary multi-call operations on a worker with such a Lease.
+class DbClientPool : public DbBackend {
+public:
+    DbClientPool(const std::string& host, uint16_t port, size_t size);
+    ~DbClientPool() override;
+
+    DbClientPool(const DbClientPool&) = delete;
+    DbClientPool& operator=(const DbClientPool&) = delete;
+
+    // Exclusive use of one connection; returned to the pool on destruction.
+    class Lease {
+    public:
+        Lease(DbClientPool& pool, size_t slot, std::shared_ptr<DbClient> conn);
+        ~Lease();
+        Lease(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        DbClient& operator*() { return *conn; }
+        DbClient* operator->() { return conn.get(); }
+
+    private:
+        DbClientPool* pool;
+        size_t slot;
+        std::shared_ptr<DbClient> conn;
+    };
+
+    Lease checkout();   // blocks until a connection is not leased
+
+    // One near cache shared by every connection of the pool.
+    void enable_near_cache(size_t maxBytes);
+    nlohmann::json near_cache_stats();
+
+    nlohmann::json create(const std::string& coll, const nlohmann::json& data) override;
+    nlohmann::json read(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json mget(const std::string& coll, const nlohmann::json& ids) override;
+    nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                         const nlohmann::json& options = nlohmann::json::object()) override;
+    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    nlohmann::json del(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json reset(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_view(const std::string& name, const nlohmann::json& spec) override;
+    nlohmann::json call(const std::string& procedure, const nlohmann::json& args) override;
+    nlohmann::json append(const std::string& coll, const nlohmann::json& records) override;
+    nlohmann::json reserve_ids(const std::string& coll, int count) override;
+
+    std::future<nlohmann::json> create_async(const std::string& coll, const nlohmann::json& data) override;
+    std::future<nlohmann::json> read_async(const std::string& coll, const nlohmann::json& filter) override;
+    std::future<nlohmann::json> query_async(const std::string& coll, const nlohmann::json& filter,
+                                            const nlohmann::json& options = nlohmann::json::object()) override;
+    std::future<nlohmann::json> update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    std::future<nlohmann::json> del_async(const std::string& coll, const nlohmann::json& filter) override;
+
+    void create_async(const std::string& coll, const nlohmann::json& data, Callback cb) override;
+    void read_async(const std::string& coll, const nlohmann::json& filter, Callback cb) override;
+    void query_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& options, Callback cb) override;
+    void update_async(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data, Callback cb) override;
+    void del_async(const std::string& coll, const nlohmann::json& filter, Callback cb) override;
+
+    std::future<nlohmann::json> submit(Op op) override;
+    void submit(Op op, Callback cb) override;
+
+private:
+    std::string host;
+    uint16_t port;
+
+    struct Slot {
+        std::shared_ptr<DbClient> conn;     // null or dead: reopen on next use
+        bool leased = false;
+    };
+
+    std::mutex mtx;
+    std::condition_variable connCv;
+    std::vector<Slot> slots;
+    size_t nextSlot = 0;
+    std::shared_ptr<NearCache> nearCache;
+
+    std::mutex taskMtx;
+    std::condition_variable taskCv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    std::shared_ptr<DbClient> ensure_open(Slot& slot);
+    std::shared_ptr<DbClient> pick();
+    void give_back(size_t slot);
+    nlohmann::json run(const Op& op);
+    void enqueue(std::function<void()> task);
+    void worker_loop();
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "cluster_db_client.hpp"
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+// Admin tool for a set of db_server nodes sharded by ClusterDbClient:
+//   db_cluster --nodes h:p,h:p stats
+//   db_cluster --nodes h:p,h:p add h:p      (rebalances onto the new node)
+static vector<string> split_nodes(const string& list) {
+    vector<string> out;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+static int usage() {
+    cerr << "usage: db_cluster --nodes host:port[,host:port...] (stats | add host:port)\n";
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    vector<string> nodes;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string k = argv[i];
+        if (k == "--nodes" && i + 1 < argc) nodes = split_nodes(argv[++i]);
+        else args.push_back(k);
+    }
+    if (nodes.empty() || args.empty()) return usage();
+
+    try {
+        ClusterDbClient cluster(nodes);
+        if (args[0] == "stats" && args.size() == 1) {
+            cout << cluster.stats().dump(2) << "\n";
+        } else if (args[0] == "add" && args.size() == 2) {
+            nlohmann::json r = cluster.add_node(args[1]);
+            cout << r.dump() << "\n";
+            if (r.value("status", "") != "ok") return 1;
+        } else {
+            return usage();
+        }
+    } catch (const std::exception& e) {
+        cerr << "[DB cluster] " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
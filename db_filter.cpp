@@ -0,0 +1,124 @@
+#include "db_filter.hpp"
+#include "db_index.hpp"
+#include <cctype>
+
+using nlohmann::json;
+
+static bool is_operator(const json& cond) {
+    return cond.is_object() && !cond.empty() && cond.begin().key()[0] == '$';
+}
+
+// Orders two numbers or two strings; anything else is incomparable.
+static bool compare(const json& a, const json& b, int& cmp) {
+    if (a.is_number() && b.is_number()) {
+        double x = a.get<double>(), y = b.get<double>();
+        cmp = x < y ? -1 : (x > y ? 1 : 0);
+        return true;
+    }
+    if (a.is_string() && b.is_string()) {
+        cmp = a.get_ref<const std::string&>().compare(b.get_ref<const std::string&>());
+        return true;
+    }
+    return false;
+}
+
+Predicate::Predicate(const json& filter) {
+    if (!filter.is_object()) return;
+
+    for (auto it = filter.begin(); it != filter.end(); ++it) {
+        add(FieldPath(it.key()), it.value());
+    }
+}
+
+void Predicate::add(const FieldPath& path, const json& cond) {
+    if (!is_operator(cond)) {
+        conds.push_back({Kind::Equal, path, cond, "", false, nullptr});
+        return;
+    }
+
+    bool caseFold = cond.value("$caseFold", false);
+    for (auto op = cond.begin(); op != cond.end(); ++op) {
+        if (op.key() == "$prefix" && op->is_string()) {
+            std::string p = op->get<std::string>();
+            conds.push_back({Kind::Prefix, path, nullptr,
+                             caseFold ? fold_case(p) : p, caseFold, nullptr});
+        } else if (op.key() == "$gt" || op.key() == "$gte"
+                   || op.key() == "$lt" || op.key() == "$lte") {
+            Kind kind = op.key() == "$gt"  ? Kind::Greater
+                      : op.key() == "$gte" ? Kind::GreaterEq
+                      : op.key() == "$lt"  ? Kind::Less
+                                           : Kind::LessEq;
+            conds.push_back({kind, path, *op, "", false, nullptr});
+        } else if (op.key() == "$in" && op->is_array()) {
+            conds.push_back({Kind::In, path, *op, "", false, nullptr});
+        } else if (op.key() == "$contains") {
+            conds.push_back({Kind::Contains, path, *op, "", false, nullptr});
+        } else if (op.key() == "$elemMatch" && op->is_object()) {
+            // Operators apply to each element itself; a plain filter
+            // applies to each (object) element's fields.
+            std::shared_ptr<Predicate> elem(new Predicate());
+            if (is_operator(*op)) elem->add(FieldPath(), *op);
+            else *elem = Predicate(*op);
+            conds.push_back({Kind::ElemMatch, path, nullptr, "", false, std::move(elem)});
+        } else if (op.key() == "$caseFold") {
+            // modifier for $prefix
+        } else {
+            never = true;   // unknown operator or bad argument
+        }
+    }
+}
+
+bool Predicate::test(const Condition& c, const json* value) {
+    switch (c.kind) {
+    case Kind::Equal:
+        return value && *value == c.value;
+    case Kind::In:
+        if (!value) return false;
+        for (const auto& v : c.value) {
+            if (*value == v) return true;
+        }
+        return false;
+    case Kind::Prefix: {
+        if (!value || !value->is_string()) return false;
+        const std::string& v = value->get_ref<const std::string&>();
+        if (v.size() < c.prefix.size()) return false;
+        if (!c.caseFold) return v.compare(0, c.prefix.size(), c.prefix) == 0;
+        for (size_t i = 0; i < c.prefix.size(); ++i) {
+            if ((char)std::tolower((unsigned char)v[i]) != c.prefix[i]) return false;
+        }
+        return true;
+    }
+    case Kind::Greater:
+    case Kind::GreaterEq:
+    case Kind::Less:
+    case Kind::LessEq: {
+        int cmp;
+        if (!value || !compare(*value, c.value, cmp)) return false;
+        if (c.kind == Kind::Greater) return cmp > 0;
+        if (c.kind == Kind::GreaterEq) return cmp >= 0;
+        if (c.kind == Kind::Less) return cmp < 0;
+        return cmp <= 0;
+    }
+    case Kind::Contains:
+        if (!value || !value->is_array()) return false;
+        for (const auto& v : *value) {
+            if (v == c.value) return true;
+        }
+        return false;
+    case Kind::ElemMatch:
+        if (!value || !value->is_array()) return false;
+        for (const auto& v : *value) {
+            if (c.elem->matches(v)) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+bool Predicate::matches(const json& doc) const {
+    if (never) return false;
+    for (const auto& c : conds) {
+        if (!test(c, c.path.resolve(doc))) return false;
+    }
+    return true;
+}
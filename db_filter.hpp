@@ -0,0 +1,52 @@
+#ifndef DB_FILTER_HPP
+#define DB_FILTER_HPP
+
+#include "db_index.hpp"
+#include "json.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A query filter compiled once per request. Field names and operator
+// arguments (including case-folded prefixes) are resolved up front, so
+// testing a document does no parsing or allocation.
+//
+// Filter semantics: every top-level key must match. Keys are field paths
+// (see FieldPath), so "owner.name" tests a nested field. A condition
+// object whose keys start with '$' holds operators; any other value is
+// compared for equality. Unknown operators never match. A non-object
+// filter matches everything.
+//
+// Operators: $prefix (with optional $caseFold) on strings; $gt, $gte,
+// $lt, $lte between two numbers or two strings; $in (equal to any element
+// of an array); on array fields, $contains (some element equals the
+// argument) and $elemMatch (some element matches the argument, which is
+// either an operator object applied to the element or a filter applied
+// to object elements).
+class Predicate {
+public:
+    explicit Predicate(const nlohmann::json& filter);
+
+    bool matches(const nlohmann::json& doc) const;
+
+private:
+    enum class Kind { Equal, In, Prefix, Greater, GreaterEq, Less, LessEq, Contains, ElemMatch };
+
+    struct Condition {
+        Kind kind;
+        FieldPath path;
+        nlohmann::json value;   // Equal, In (array), Contains and comparisons
+        std::string prefix;     // Prefix; already folded if caseFold
+        bool caseFold = false;
+        std::shared_ptr<const Predicate> elem;     // ElemMatch
+    };
+
+    std::vector<Condition> conds;
+    bool never = false;     // an unknown operator makes the filter unsatisfiable
+
+    Predicate() = default;
+    void add(const FieldPath& path, const nlohmann::json& cond);
+    static bool test(const Condition& c, const nlohmann::json* value);
+};
+
+#endif
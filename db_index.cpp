@@ -0,0 +1,213 @@
+#include "db_index.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+using nlohmann::json;
+
+std::string fold_case(const std::string& s) {
+    std::string out = s;
+    for (auto& ch : out) ch = (char)std::tolower((unsigned char)ch);
+    return out;
+}
+
+// ---- FieldPath ----
+
+FieldPath::FieldPath(const std::string& field) {
+    size_t start = 0;
+    while (true) {
+        size_t dot = field.find('.', start);
+        std::string key = field.substr(start, dot == std::string::npos ? std::string::npos : dot - start);
+        bool numeric = !key.empty() && key.size() < 10
+                       && std::all_of(key.begin(), key.end(), [](char ch) { return std::isdigit((unsigned char)ch); });
+        segments.push_back({key, numeric, numeric ? std::stoul(key) : 0});
+        if (dot == std::string::npos) break;
+        start = dot + 1;
+    }
+}
+
+const json* FieldPath::resolve(const json& doc) const {
+    const json* cur = &doc;
+    for (const auto& seg : segments) {
+        if (cur->is_object()) {
+            auto it = cur->find(seg.key);
+            if (it == cur->end()) return nullptr;
+            cur = &*it;
+        } else if (cur->is_array() && seg.numeric && seg.index < cur->size()) {
+            cur = &(*cur)[seg.index];
+        } else {
+            return nullptr;
+        }
+    }
+    return cur;
+}
+
+// ---- SecondaryIndex ----
+
+SecondaryIndex::SecondaryIndex(const json& spec) : m_spec(spec) {
+    if (!spec.contains("field") || !spec["field"].is_string() || spec["field"].get<std::string>().empty())
+        throw std::invalid_argument("index spec needs a field");
+    m_field = spec["field"].get<std::string>();
+    m_path = FieldPath(m_field);
+}
+
+// ---- SortedStringIndex ----
+
+SortedStringIndex::SortedStringIndex(const json& spec)
+    : SecondaryIndex(spec), caseFold(spec.value("caseFold", false)) {}
+
+bool SortedStringIndex::key_of(const json& doc, std::string& key) const {
+    const json* v = value_of(doc);
+    if (!v || !v->is_string()) return false;
+    key = caseFold ? fold_case(v->get<std::string>()) : v->get<std::string>();
+    return true;
+}
+
+void SortedStringIndex::insert(int id, const json& doc) {
+    std::string key;
+    if (key_of(doc, key)) entries.emplace(std::move(key), id);
+}
+
+void SortedStringIndex::remove(int id, const json& doc) {
+    std::string key;
+    if (!key_of(doc, key)) return;
+    auto range = entries.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == id) {
+            entries.erase(it);
+            return;
+        }
+    }
+}
+
+bool SortedStringIndex::exact(const json& cond) const {
+    if (cond.is_string()) return !caseFold;
+    if (cond.is_object() && cond.contains("$prefix")) {
+        // Any operator besides $prefix/$caseFold narrows the match further.
+        if (cond.size() != (cond.contains("$caseFold") ? 2u : 1u)) return false;
+        return cond.value("$caseFold", false) == caseFold;
+    }
+    return false;
+}
+
+bool SortedStringIndex::lookup(const json& cond, std::vector<int>& out, size_t maxOut) const {
+    if (!exact(cond)) maxOut = 0;
+
+    if (cond.is_string()) {
+        std::string key = caseFold ? fold_case(cond.get<std::string>()) : cond.get<std::string>();
+        auto range = entries.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            out.push_back(it->second);
+            if (maxOut && out.size() >= maxOut) break;
+        }
+        return true;
+    }
+
+    if (!cond.is_object() || !cond.contains("$prefix") || !cond["$prefix"].is_string())
+        return false;
+    // A case-sensitive index cannot enumerate case-insensitive matches.
+    if (cond.value("$caseFold", false) && !caseFold)
+        return false;
+
+    std::string prefix = cond["$prefix"].get<std::string>();
+    if (caseFold) prefix = fold_case(prefix);
+    for (auto it = entries.lower_bound(prefix); it != entries.end(); ++it) {
+        if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+        out.push_back(it->second);
+        if (maxOut && out.size() >= maxOut) break;
+    }
+    return true;
+}
+
+// ---- HashIndex ----
+
+HashIndex::HashIndex(const json& spec) : SecondaryIndex(spec) {}
+
+// Keys follow json equality: numbers that compare equal (1 and 1.0) share
+// a key. Objects and arrays are not indexable keys.
+bool HashIndex::key_of(const json& value, std::string& key) {
+    if (value.is_object() || value.is_array()) return false;
+    if (value.is_number_float()) {
+        double d = value.get<double>();
+        if (std::isfinite(d) && d == std::trunc(d) && std::fabs(d) < 9.0e15) {
+            key = std::to_string(static_cast<int64_t>(d));
+            return true;
+        }
+    }
+    key = value.dump();
+    return true;
+}
+
+std::vector<std::string> HashIndex::keys_of(const json& doc) const {
+    std::vector<std::string> keys;
+    const json* v = value_of(doc);
+    if (!v) return keys;
+    std::string key;
+    if (v->is_array()) {
+        for (const auto& elem : *v) {
+            if (key_of(elem, key)) keys.push_back(key);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    } else if (key_of(*v, key)) {
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+void HashIndex::insert(int id, const json& doc) {
+    for (auto& key : keys_of(doc)) entries[key].insert(id);
+}
+
+void HashIndex::remove(int id, const json& doc) {
+    for (auto& key : keys_of(doc)) {
+        auto it = entries.find(key);
+        if (it == entries.end()) continue;
+        it->second.erase(id);
+        if (it->second.empty()) entries.erase(it);
+    }
+}
+
+bool HashIndex::lookup(const json& cond, std::vector<int>& out, size_t) const {
+    std::vector<const json*> values;
+    if (!cond.is_object()) {
+        values.push_back(&cond);
+    } else if (cond.contains("$contains")) {
+        values.push_back(&cond["$contains"]);
+    } else if (cond.contains("$in") && cond["$in"].is_array()) {
+        for (const auto& v : cond["$in"]) values.push_back(&v);
+    } else {
+        return false;
+    }
+
+    std::vector<std::string> keys;
+    std::string key;
+    for (const json* v : values) {
+        if (!key_of(*v, key)) return false;
+        keys.push_back(key);
+    }
+
+    size_t first = out.size();
+    for (const auto& k : keys) {
+        auto it = entries.find(k);
+        if (it != entries.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+    }
+    // Several values may hit the same document; keep candidates unique and
+    // in id order.
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+    return true;
+}
+
+// ---- factory ----
+
+std::unique_ptr<SecondaryIndex> make_index(const json& spec) {
+    if (!spec.is_object())
+        throw std::invalid_argument("index spec must be object");
+    std::string type = spec.value("type", "");
+    if (type == "prefix") return std::make_unique<SortedStringIndex>(spec);
+    if (type == "hash") return std::make_unique<HashIndex>(spec);
+    throw std::invalid_argument("unknown index type");
+}
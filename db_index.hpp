@@ -0,0 +1,110 @@
+#ifndef DB_INDEX_HPP
+#define DB_INDEX_HPP
+
+#include "json.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+std::string fold_case(const std::string& s);
+
+// A field name split at dots: "owner.name" reaches into nested objects and
+// a numeric segment ("players.0") indexes into an array. A default
+// constructed path refers to the value itself.
+class FieldPath {
+public:
+    FieldPath() = default;
+    explicit FieldPath(const std::string& field);
+
+    // The value at this path, or nullptr if any step is missing.
+    const nlohmann::json* resolve(const nlohmann::json& doc) const;
+
+private:
+    struct Segment {
+        std::string key;
+        bool numeric;
+        size_t index;       // valid if numeric
+    };
+    std::vector<Segment> segments;
+};
+
+// A secondary index over one field of a collection, kept up to date by the
+// owning InMemoryCollection on every create/update/delete.
+class SecondaryIndex {
+public:
+    explicit SecondaryIndex(const nlohmann::json& spec);
+    virtual ~SecondaryIndex() = default;
+
+    const nlohmann::json& spec() const { return m_spec; }
+    const std::string& field() const { return m_field; }
+    // The indexed value of doc, or nullptr if it has none.
+    const nlohmann::json* value_of(const nlohmann::json& doc) const { return m_path.resolve(doc); }
+
+    virtual void insert(int id, const nlohmann::json& doc) = 0;
+    virtual void remove(int id, const nlohmann::json& doc) = 0;
+    virtual void clear() = 0;
+
+    // Candidate ids for one filter condition on field(). Returns false if
+    // the index cannot answer this kind of condition. Candidates are a
+    // superset of the matches; at most maxOut are produced when the
+    // index's answer is exact (see exact()), otherwise maxOut is ignored.
+    virtual bool lookup(const nlohmann::json& cond, std::vector<int>& out, size_t maxOut) const = 0;
+    virtual bool exact(const nlohmann::json& cond) const = 0;
+
+private:
+    nlohmann::json m_spec;
+    std::string m_field;
+    FieldPath m_path;
+};
+
+// Ordered string index ("type":"prefix"): serves equality and $prefix
+// conditions on string fields. With "caseFold":true keys are lower-cased,
+// so it also serves case-insensitive prefix search.
+class SortedStringIndex : public SecondaryIndex {
+public:
+    explicit SortedStringIndex(const nlohmann::json& spec);
+
+    void insert(int id, const nlohmann::json& doc) override;
+    void remove(int id, const nlohmann::json& doc) override;
+    void clear() override { entries.clear(); }
+
+    bool lookup(const nlohmann::json& cond, std::vector<int>& out, size_t maxOut) const override;
+    bool exact(const nlohmann::json& cond) const override;
+
+private:
+    bool caseFold;
+    std::multimap<std::string, int> entries;
+
+    bool key_of(const nlohmann::json& doc, std::string& key) const;
+};
+
+// Multikey hash index ("type":"hash"): a scalar value is indexed as is
+// and an array under each distinct element, so equality, $contains and
+// $in on scalars are answered with one hash lookup per value. Candidates
+// still go through the filter, since e.g. {"players":7} and
+// {"players":{"$contains":7}} share a key.
+class HashIndex : public SecondaryIndex {
+public:
+    explicit HashIndex(const nlohmann::json& spec);
+
+    void insert(int id, const nlohmann::json& doc) override;
+    void remove(int id, const nlohmann::json& doc) override;
+    void clear() override { entries.clear(); }
+
+    bool lookup(const nlohmann::json& cond, std::vector<int>& out, size_t maxOut) const override;
+    bool exact(const nlohmann::json&) const override { return false; }
+
+private:
+    std::unordered_map<std::string, std::unordered_set<int>> entries;
+
+    static bool key_of(const nlohmann::json& value, std::string& key);
+    std::vector<std::string> keys_of(const nlohmann::json& doc) const;
+};
+
+// Builds an index from its spec; throws std::invalid_argument on a bad spec.
+std::unique_ptr<SecondaryIndex> make_index(const nlohmann::json& spec);
+
+#endif
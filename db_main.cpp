@@ -1,13 +1,56 @@
 #include "db_server.hpp"
 #include <iostream>
+#include <thread>
+#include <vector>
 using namespace std;
 
-int main() {
-    constexpr uint16_t DB_PORT = 12000;
+int main(int argc, char** argv) {
+    uint16_t port = 12000;
+    size_t queryCacheEntries = 0;
+    string dataDir = "db";
+    int leaseMs = 2000;
+    size_t memoryBudget = 0;
+    size_t scanThreads = std::thread::hardware_concurrency();
+    size_t maxScan = 0;         // default per-request scan limits, 0 = none
+    int maxTimeMs = 0;
+    vector<string> plugins;     // --plugin may repeat
+    string codec = "zlib";      // for data files written from now on
+    size_t ioThreads = 0;       // 0 = DbServer's default
+    string io = "epoll";        // epoll | uring (falls back to epoll)
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string k = argv[i];
+        string v = argv[i+1];
+        if (k == "--port") port = static_cast<uint16_t>(stoi(v));
+        else if (k == "--query-cache") queryCacheEntries = stoul(v);
+        else if (k == "--data-dir") dataDir = v;
+        else if (k == "--lease-ms") leaseMs = stoi(v);
+        else if (k == "--memory-budget") memoryBudget = stoul(v);
+        else if (k == "--scan-threads") scanThreads = stoul(v);
+        else if (k == "--max-scan") maxScan = stoul(v);
+        else if (k == "--max-time-ms") maxTimeMs = stoi(v);
+        else if (k == "--plugin") plugins.push_back(v);
+        else if (k == "--codec") codec = v;
+        else if (k == "--io-threads") ioThreads = stoul(v);
+        else if (k == "--io") io = v;
+    }
+
+    if (io != "epoll" && io != "uring") {
+        cerr << "[DB] unknown --io backend: " << io << "\n";
+        return 1;
+    }
 
     try {
-        DbServer server(DB_PORT);
-        cout << "[DB] Starting on port " << DB_PORT <<"\n" ;
+        DbServer server(port, dataDir);
+        server.database().enable_query_cache(queryCacheEntries);
+        server.set_lease_ms(leaseMs);
+        if (ioThreads) server.set_io_workers(ioThreads);
+        if (io == "uring") server.set_io_backend(Reactor::Backend::IoUring);
+        server.database().set_memory_budget(memoryBudget);
+        server.database().set_scan_threads(scanThreads);
+        server.database().set_query_limits(maxScan, maxTimeMs);
+        server.database().set_storage_codec(codec);
+        for (const auto& path : plugins) server.database().load_plugin(path);
+        cout << "[DB] Starting on port " << port <<"\n" ;
         server.run(); 
     } catch (const std::exception& e) {
         cerr << "[DB] Fatal error: " << e.what() << "\n" ;
@@ -0,0 +1,23 @@
+#include "db_plugin.hpp"
+#include <dlfcn.h>
+#include <stdexcept>
+
+// Handles are never closed: procedures stay registered for the life of
+// the process.
+void load_plugin(const std::string& path, ProcedureRegistry& registry) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) throw std::runtime_error(std::string("cannot load plugin: ") + dlerror());
+
+    auto abi = reinterpret_cast<int (*)()>(dlsym(handle, "db_plugin_abi"));
+    auto reg = reinterpret_cast<void (*)(ProcedureRegistry&)>(dlsym(handle, "db_plugin_register"));
+    if (!abi || !reg) {
+        dlclose(handle);
+        throw std::runtime_error(path + ": missing db_plugin_abi or db_plugin_register");
+    }
+    if (abi() != DB_PLUGIN_ABI) {
+        dlclose(handle);
+        throw std::runtime_error(path + ": plugin ABI " + std::to_string(abi())
+                                 + ", server ABI " + std::to_string(DB_PLUGIN_ABI));
+    }
+    reg(registry);
+}
@@ -0,0 +1,59 @@
+#ifndef DB_PLUGIN_HPP
+#define DB_PLUGIN_HPP
+
+#include "json.hpp"
+#include <string>
+
+// Stored procedures: C++ functions compiled into a shared object that
+// db_server loads with --plugin and runs on a `call` request:
+//   {"action":"call", "procedure":"joinRoom", "data":{...args}}
+//
+// A procedure runs under the database's exclusive lock, so no other
+// request sees its intermediate state, and its writes are all-or-nothing:
+// if it throws or returns {"status":"error",...} every write it made is
+// undone. Files are written once the procedure has returned (and been
+// rolled back if it failed), so they never hold its partial writes; a
+// crash mid-call loses the whole call. A result without "status" is
+// returned with "status":"ok".
+//
+// Plugins are built against this header and json.hpp with the same
+// compiler as db_server (nlohmann::json crosses the boundary by value),
+// with -fPIC -shared, and export the two entry points below:
+//
+//   DB_PLUGIN_EXPORT int db_plugin_abi() { return DB_PLUGIN_ABI; }
+//   DB_PLUGIN_EXPORT void db_plugin_register(ProcedureRegistry& r) {
+//       r.add("joinRoom", join_room);
+//   }
+
+#define DB_PLUGIN_ABI 1
+#define DB_PLUGIN_EXPORT extern "C" __attribute__((visibility("default")))
+
+// The database as a procedure sees it. Responses are the same as for the
+// corresponding request actions.
+class ProcedureContext {
+public:
+    virtual ~ProcedureContext() = default;
+
+    virtual nlohmann::json read(const std::string& coll, const nlohmann::json& filter) = 0;
+    virtual nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                                 const nlohmann::json& options = nlohmann::json::object()) = 0;
+    virtual nlohmann::json create(const std::string& coll, const nlohmann::json& data) = 0;
+    virtual nlohmann::json update(const std::string& coll, const nlohmann::json& filter,
+                                  const nlohmann::json& data) = 0;
+    virtual nlohmann::json del(const std::string& coll, const nlohmann::json& filter) = 0;
+};
+
+using Procedure = nlohmann::json (*)(ProcedureContext& db, const nlohmann::json& args);
+
+class ProcedureRegistry {
+public:
+    virtual ~ProcedureRegistry() = default;
+    // A later registration under the same name replaces the earlier one.
+    virtual void add(const std::string& name, Procedure fn) = 0;
+};
+
+// Loads one plugin and registers its procedures; throws std::runtime_error
+// if it cannot be opened, lacks the entry points or has another ABI.
+void load_plugin(const std::string& path, ProcedureRegistry& registry);
+
+#endif
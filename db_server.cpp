@@ -1,215 +1,165 @@
 #include "db_server.hpp"
 #include <iostream>
-#include <fstream>
 
 using nlohmann::json;
 
-// ---- Database core ----
+// ---- DbServer ----
 
-bool Database::match_filter(const json& doc, const json& filter) {
-    if (!filter.is_object()) return true;
-    for (auto it = filter.begin(); it != filter.end(); ++it) {
-        const std::string& key = it.key();
-        if (!doc.contains(key) || doc[key] != it.value()) {
-            return false;
-        }
-    }
-    return true;
+DbServer::DbServer(uint16_t p, const std::string& dir) : port(p), dataDir(dir) {}
+
+// Mutations committed by the current handler thread, published to lease
+// holders once the database lock has been released.
+static thread_local std::vector<std::pair<std::string, std::vector<int>>> tlMutations;
+
+// Responses are serialized JSON objects (possibly shared via the query
+// cache); add per-request members such as reqId by splicing them in at the
+// front rather than re-encoding the body.
+static std::string with_member(const std::string& name, const json& value, const std::string& body) {
+    if (body.size() < 2 || body[0] != '{') return body;
+    std::string out = "{\"" + name + "\":" + value.dump();
+    if (body.size() > 2) out += ',';
+    out.append(body, 1, std::string::npos);
+    return out;
 }
 
-json Database::handle_create(const std::string& coll, const json& data) {
-    if (!data.is_object())
-        return {{"status","error"},{"message","data must be object"}};
-
-    auto& c = collections[coll];
-    json doc = data;
-
-    if (!doc.contains("id") || !doc["id"].is_number_integer()) {
-        doc["id"] = c.nextId++;
-    } else {
-        int id = doc["id"].get<int>();
-        if (c.docs.count(id)) {
-            return {{"status","error"},{"message","id already exists"}};
-        }
-        if (id >= c.nextId) c.nextId = id + 1;
-    }
-
-    int id = doc["id"].get<int>();
-    c.docs[id] = doc;
-    return {{"status","ok"},{"data",doc}};
+void DbServer::set_lease_ms(int ms) {
+    leaseMs = ms;
 }
 
-json Database::handle_read(const std::string& coll, const json& filter) {
-    auto itc = collections.find(coll);
-    if (itc == collections.end())
-        return {{"status","ok"},{"data",nullptr}};
-
-    for (auto& [id, doc] : itc->second.docs) {
-        if (match_filter(doc, filter)) {
-            return {{"status","ok"},{"data",doc}};
-        }
-    }
-    return {{"status","ok"},{"data",nullptr}};
+void DbServer::set_io_workers(size_t n) {
+    ioWorkers = n;
 }
 
-json Database::handle_query(const std::string& coll, const json& filter) {
-    json arr = json::array();
-    auto itc = collections.find(coll);
-    if (itc != collections.end()) {
-        for (auto& [id, doc] : itc->second.docs) {
-            if (match_filter(doc, filter)) {
-                arr.push_back(doc);
-            }
-        }
-    }
-    return {{"status","ok"},{"items",arr}};
+void DbServer::set_io_backend(Reactor::Backend backend) {
+    ioBackend = backend;
 }
 
-json Database::handle_update(const std::string& coll, const json& filter, const json& data) {
-    if (!data.is_object())
-        return {{"status","error"},{"message","data must be object"}};
-
-    auto itc = collections.find(coll);
-    if (itc == collections.end())
-        return {{"status","ok"},{"updated",0}};
-
-    int count = 0;
-    for (auto& [id, doc] : itc->second.docs) {
-        if (match_filter(doc, filter)) {
-            for (auto it = data.begin(); it != data.end(); ++it) {
-                doc[it.key()] = it.value();
-            }
-            ++count;
-        }
-    }
-    return {{"status","ok"},{"updated",count}};
+void DbServer::grant_lease(int conn, const std::string& coll) {
+    auto expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(leaseMs);
+    std::lock_guard<std::mutex> lock(leaseMtx);
+    leases[coll][conn] = expires;
 }
 
-json Database::handle_delete(const std::string& coll, const json& filter) {
-    auto itc = collections.find(coll);
-    if (itc == collections.end())
-        return {{"status","ok"},{"deleted",0}};
-
-    int count = 0;
-    for (auto it = itc->second.docs.begin(); it != itc->second.docs.end(); ) {
-        if (match_filter(it->second, filter)) {
-            it = itc->second.docs.erase(it);
-            ++count;
-        } else {
-            ++it;
-        }
-    }
-    return {{"status","ok"},{"deleted",count}};
+void DbServer::drop_leases(int conn) {
+    std::lock_guard<std::mutex> lock(leaseMtx);
+    for (auto& [coll, holders] : leases) holders.erase(conn);
 }
 
-json Database::handle_request(const json& req) {
-    std::lock_guard<std::mutex> lock(mtx);
-
-    if (!req.contains("collection") || !req.contains("action"))
-        return {{"status","error"},{"message","missing collection or action"}};
-
+// A bulk load is open from its first batch until the one marked done.
+void DbServer::track_bulk_load(int conn, const json& req) {
+    if (req.value("action", "") != "bulkLoad" || !req.contains("collection")
+        || !req["collection"].is_string())
+        return;
+    const json& opts = req.value("options", json::object());
+    bool done = opts.is_object() && opts.value("done", false);
     std::string coll = req["collection"].get<std::string>();
-    std::string action = req["action"].get<std::string>();
-    json filter = req.value("filter", json::object());
-    json data = req.value("data", json::object());
-
-    json result;
-    bool mutated = false;
-    if (action == "create"){
-        result =  handle_create(coll, data);
-        mutated = (result["status"] == "ok");
-    }else if (action == "read"){
-        result = handle_read(coll, filter);
-    }else if (action == "query"){  
-        result = handle_query(coll, filter);
-    }else if (action == "update"){
-        result = handle_update(coll, filter, data);
-        mutated = (result["status"] == "ok");
-    }else if (action == "delete"){
-        result = handle_delete(coll, filter);
-        mutated = (result["status"] == "ok");
-    }else if(action == "reset"){
-        collections.clear();
-        save_to_file("db.json");
-        result = {{"status","ok"},{"message","all cleared"}};
-    }else  result =  {{"status","error"},{"message","unknown action"}};
-
-    if(mutated){
-        save_to_file("db.json");
+    std::lock_guard<std::mutex> lock(bulkMtx);
+    if (done) {
+        auto it = bulkLoads.find(conn);
+        if (it == bulkLoads.end()) return;
+        it->second.erase(coll);
+        if (it->second.empty()) bulkLoads.erase(it);
+    } else {
+        bulkLoads[conn].insert(coll);
     }
-
-    return result;
-    
 }
 
-void Database::load_from_file(const std::string& path) {
-    std::ifstream in(path);
-    if (!in) return; 
-
-    nlohmann::json j;
-    in >> j;
-    collections.clear();
-    for (auto it = j.begin(); it != j.end(); ++it) {
-        const std::string collName = it.key();
-        const auto& arr = it.value();
-        InMemoryCollection c;
-        c.nextId = 1;
-        for (const auto& doc : arr) {
-            if (!doc.contains("id") || !doc["id"].is_number_integer()) continue;
-            int id = doc["id"].get<int>();
-            c.docs[id] = doc;
-            if (id >= c.nextId) c.nextId = id + 1;
-        }
-        collections[collName] = std::move(c);
+// Finishes the loads a closing connection left open, keeping the batches
+// that arrived: otherwise the collection would stay unindexed and never
+// be written back.
+void DbServer::finish_bulk_loads(int conn) {
+    std::set<std::string> open;
+    {
+        std::lock_guard<std::mutex> lock(bulkMtx);
+        auto it = bulkLoads.find(conn);
+        if (it == bulkLoads.end()) return;
+        open.swap(it->second);
+        bulkLoads.erase(it);
+    }
+    for (const auto& coll : open) {
+        json r = db.handle_request({{"action","bulkLoad"},{"collection",coll},
+                                    {"data",json::array()},{"options",{{"done",true}}}});
+        std::cerr << "[DB] connection closed during bulk load of " << coll << ": "
+                  << (r.value("status", "") == "ok" ? "finished" : r.value("message", "failed")) << "\n";
     }
+    publish_invalidations();
 }
 
-void Database::save_to_file(const std::string& path) {
-    nlohmann::json j;
-    for (auto& [name, coll] : collections) {
-        nlohmann::json arr = nlohmann::json::array();
-        for (auto& [id, doc] : coll.docs) {
-            arr.push_back(doc);
+void DbServer::publish_invalidations() {
+    std::vector<std::pair<std::string, std::vector<int>>> mutations;
+    mutations.swap(tlMutations);
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto& [coll, ids] : mutations) {
+        std::vector<int> targets;
+        {
+            std::lock_guard<std::mutex> lock(leaseMtx);
+            auto it = leases.find(coll);
+            if (it == leases.end()) continue;
+            for (auto h = it->second.begin(); h != it->second.end(); ) {
+                if (h->second <= now) {
+                    h = it->second.erase(h);    // holder's copy has expired too
+                } else {
+                    targets.push_back(h->first);
+                    ++h;
+                }
+            }
         }
-        j[name] = arr;
-    }
-    std::ofstream out(path);
-    if (out) {
-        out << j.dump(2);
+        if (targets.empty()) continue;
+
+        std::string msg = json{
+            {"event","invalidate"},
+            {"collection",coll},
+            {"ids",ids}
+        }.dump();
+        for (int conn : targets) reactor->send(conn, msg);
     }
 }
 
-
-
-// ---- DbServer ----
-
-DbServer::DbServer(uint16_t p) : port(p) {}
-
-void DbServer::handle_client(TcpSocket client) {
-    int fd = client.fd();
-    try {
-        while (true) {
-            json req = recv_json(fd);
-            json resp = db.handle_request(req);
-            send_json(fd, resp);
-        }
-    } catch (const std::exception& e) {
-        // std::cerr << "[DB] client handler ended: " << e.what() << "\n";
-    }
+// Requests of one connection are handled in arrival order; pipelining
+// clients do not wait for a reply before sending the next frame.
+void DbServer::handle_frame(int conn, const std::string& body) {
+    json req = json::parse(body);
+
+    // Register the lease before the read runs, so any mutation that
+    // commits after it is guaranteed to notify this connection.
+    bool lease = leaseMs > 0 && req.value("action", "") == "read"
+                 && req.value("lease", false)
+                 && req.contains("collection") && req["collection"].is_string();
+    if (lease) grant_lease(conn, req["collection"].get<std::string>());
+    track_bulk_load(conn, req);
+
+    std::string resp = db.handle_request_serialized(req);
+    publish_invalidations();
+
+    if (lease) resp = with_member("leaseMs", leaseMs, resp);
+    if (req.contains("reqId")) resp = with_member("reqId", req["reqId"], resp);
+    if (!reactor->send(conn, resp)) reactor->close(conn);
 }
 
 void DbServer::run() {
-    db.load_from_file("db.json");
-    TcpSocket listener;
-    listener.bind_and_listen(port);
-    std::cout << "[DB] Listening on port " << port << "\n";
+    db.open(dataDir);
+    db.set_mutation_listener([](const std::string& coll, const std::vector<int>& ids) {
+        tlMutations.emplace_back(coll, ids);
+    });
 
-    while (true) {
+    Reactor::Handlers handlers;
+    handlers.on_frame = [this](int conn, std::string body) {
         try {
-            TcpSocket client = listener.accept_conn();
-            std::thread(&DbServer::handle_client, this, std::move(client)).detach();
-        } catch (const std::exception& e) {
-            std::cerr << "[DB] accept error: " << e.what() << "\n";
+            handle_frame(conn, body);
+        } catch (...) {
+            // A mutation may have committed before the throw; its lease
+            // holders must still hear of it.
+            publish_invalidations();
+            throw;
         }
-    }
+    };
+    handlers.on_close = [this](int conn) {
+        drop_leases(conn);
+        finish_bulk_loads(conn);
+    };
+    reactor = std::make_unique<Reactor>(ioWorkers, std::move(handlers), ioBackend);
+
+    std::cout << "[DB] Listening on port " << port << "\n";
+    reactor->run(port);
 }
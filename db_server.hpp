@@ -2,47 +2,63 @@
 #define DB_SERVER_HPP
 
 #include "protocol.hpp"
+#include "database.hpp"
 #include "json.hpp"
-#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <thread>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-class InMemoryCollection {
-public:
-    int nextId = 1;
-    std::unordered_map<int, nlohmann::json> docs;
-};
-
-class Database {
+class DbServer {
 public:
-    nlohmann::json handle_request(const nlohmann::json& req);
-    void load_from_file(const std::string& path);
-    void save_to_file(const std::string& path);
-
-private:
-    std::mutex mtx;
-    std::unordered_map<std::string, InMemoryCollection> collections;
+    explicit DbServer(uint16_t port, const std::string& dataDir = "db");
 
-    nlohmann::json handle_create(const std::string& coll, const nlohmann::json& data);
-    nlohmann::json handle_read(const std::string& coll, const nlohmann::json& filter);
-    nlohmann::json handle_query(const std::string& coll, const nlohmann::json& filter);
-    nlohmann::json handle_update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data);
-    nlohmann::json handle_delete(const std::string& coll, const nlohmann::json& filter);
+    void run(); 
 
-    bool match_filter(const nlohmann::json& doc, const nlohmann::json& filter);
-};
+    Database& database() { return db; }
 
-class DbServer {
-public:
-    explicit DbServer(uint16_t port);
+    // How long a client may serve a leased read from its near cache.
+    // Lease holders are sent an invalidation when the collection changes.
+    // 0 disables leases.
+    void set_lease_ms(int ms);
 
-    void run(); 
+    // Threads that handle requests; connections are multiplexed over them
+    // by a Reactor. A request waiting for the database lock holds its
+    // thread, so keep a few more than cores (currentOp/killOp need one
+    // free). Set before run().
+    void set_io_workers(size_t n);
+    // epoll by default; see Reactor::Backend. Set before run().
+    void set_io_backend(Reactor::Backend backend);
 
 private:
     uint16_t port;
+    std::string dataDir;
     Database db;
+    size_t ioWorkers = std::max(4u, 2 * std::thread::hardware_concurrency());
+    Reactor::Backend ioBackend = Reactor::Backend::Epoll;
+    std::unique_ptr<Reactor> reactor;
+
+    int leaseMs = 2000;
+    std::mutex leaseMtx;
+    // collection -> lease holder (connection) -> expiry
+    std::unordered_map<std::string,
+        std::unordered_map<int, std::chrono::steady_clock::time_point>> leases;
+
+    std::mutex bulkMtx;
+    // connection -> collections it has bulk loads open on
+    std::unordered_map<int, std::set<std::string>> bulkLoads;
 
-    void handle_client(TcpSocket client);
+    void handle_frame(int conn, const std::string& body);
+    void grant_lease(int conn, const std::string& coll);
+    void drop_leases(int conn);
+    void track_bulk_load(int conn, const nlohmann::json& req);
+    void finish_bulk_loads(int conn);
+    void publish_invalidations();
 };
 
 #endif
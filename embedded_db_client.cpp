@@ -0,0 +1,63 @@
+#include "embedded_db_client.hpp"
+
+using nlohmann::json;
+
+EmbeddedDbClient::EmbeddedDbClient(const std::string& dataDir) {
+    db.open(dataDir);
+}
+
+json EmbeddedDbClient::create(const std::string& coll, const json& data) {
+    return db.create(coll, data);
+}
+
+json EmbeddedDbClient::read(const std::string& coll, const json& filter) {
+    return db.read(coll, filter);
+}
+
+json EmbeddedDbClient::mget(const std::string& coll, const json& ids) {
+    return db.mget(coll, ids);
+}
+
+json EmbeddedDbClient::query(const std::string& coll, const json& filter, const json& options) {
+    return db.query(coll, filter, options);
+}
+
+json EmbeddedDbClient::update(const std::string& coll, const json& filter, const json& data) {
+    return db.update(coll, filter, data);
+}
+
+json EmbeddedDbClient::del(const std::string& coll, const json& filter) {
+    return db.del(coll, filter);
+}
+
+json EmbeddedDbClient::reset(const std::string& coll, const json& filter) {
+    return db.handle_request({
+        {"collection", coll},
+        {"action", "reset"},
+        {"filter", filter}
+    });
+}
+
+json EmbeddedDbClient::create_index(const std::string& coll, const json& spec) {
+    return db.create_index(coll, spec);
+}
+
+json EmbeddedDbClient::create_time_series(const std::string& coll, const json& spec) {
+    return db.create_time_series(coll, spec);
+}
+
+json EmbeddedDbClient::create_view(const std::string& name, const json& spec) {
+    return db.create_view(name, spec);
+}
+
+json EmbeddedDbClient::call(const std::string& procedure, const json& args) {
+    return db.call(procedure, args);
+}
+
+json EmbeddedDbClient::append(const std::string& coll, const json& records) {
+    return db.append(coll, records);
+}
+
+json EmbeddedDbClient::reserve_ids(const std::string& coll, int count) {
+    return db.reserve_ids(coll, count);
+}
@@ -0,0 +1,34 @@
+#ifndef EMBEDDED_DB_CLIENT_HPP
+#define EMBEDDED_DB_CLIENT_HPP
+
+#include "db_client.hpp"
+#include "database.hpp"
+#include "json.hpp"
+#include <string>
+
+// Runs the Database inside the calling process: no sockets, no JSON
+// round-trip through text, just a direct call under the Database lock.
+class EmbeddedDbClient : public DbBackend {
+public:
+    explicit EmbeddedDbClient(const std::string& dataDir);
+
+    nlohmann::json create(const std::string& coll, const nlohmann::json& data) override;
+    nlohmann::json read(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json mget(const std::string& coll, const nlohmann::json& ids) override;
+    nlohmann::json query(const std::string& coll, const nlohmann::json& filter,
+                         const nlohmann::json& options = nlohmann::json::object()) override;
+    nlohmann::json update(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data) override;
+    nlohmann::json del(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json reset(const std::string& coll, const nlohmann::json& filter) override;
+    nlohmann::json create_index(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_time_series(const std::string& coll, const nlohmann::json& spec) override;
+    nlohmann::json create_view(const std::string& name, const nlohmann::json& spec) override;
+    nlohmann::json call(const std::string& procedure, const nlohmann::json& args) override;
+    nlohmann::json append(const std::string& coll, const nlohmann::json& records) override;
+    nlohmann::json reserve_ids(const std::string& coll, int count) override;
+
+private:
+    Database db;
+};
+
+#endif
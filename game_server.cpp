@@ -132,6 +132,11 @@ GameServer::GameServer(uint16_t p,
     }
 }
 
+void GameServer::report_results_to(uint16_t lobby, const std::string& token) {
+    lobbyPort = lobby;
+    reportToken = token;
+}
+
 void GameServer::enqueue_input(int userId, const std::string& action) {
     std::lock_guard<std::mutex> lock(inputMtx);
     inputQueues[userId].push(action);
@@ -514,6 +519,29 @@ void GameServer::send_game_over(const PlayerState& p1,
             send_json(pc.socket.fd(), msg);
         } catch (...) {}
     }
+    report_results(msg["results"]);
+}
+
+// Match history is recorded from this report only: the players never see
+// the report token, so neither can record a result for the other.
+void GameServer::report_results(const json& results) {
+    if (!lobbyPort) return;
+    try {
+        TcpSocket sock;
+        sock.connect_to("127.0.0.1", lobbyPort);
+        send_json(sock.fd(), {
+            {"type","GAME_RESULT"},
+            {"roomId",roomId},
+            {"reportToken",reportToken},
+            {"results",results}
+        });
+        json resp = recv_json(sock.fd());
+        if (resp.value("type","") != "OK") {
+            std::cerr << "[GameServer] Lobby rejected results: " << resp.dump() << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[GameServer] Failed to report results: " << e.what() << "\n";
+    }
 }
 
 
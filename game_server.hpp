@@ -27,11 +27,17 @@ public:
 
     void run(); 
 
+    // Report the results to the lobby at lobbyPort on this host when the
+    // game ends; reportToken is the room's secret shared with the lobby.
+    void report_results_to(uint16_t lobbyPort, const std::string& reportToken);
+
 private:
     uint16_t port;
     int roomId;
     std::string roomToken;
     std::vector<int> expectedPlayers; 
+    uint16_t lobbyPort = 0;         // 0 = results are not reported
+    std::string reportToken;
 
     std::mutex inputMtx;
     std::unordered_map<int, std::queue<std::string>> inputQueues; // userId -> actions
@@ -52,6 +58,7 @@ private:
                             const struct PlayerState& p2);
     void send_game_over(const struct PlayerState& p1,
                         const struct PlayerState& p2);
+    void report_results(const nlohmann::json& results);
 
     void enqueue_input(int userId, const std::string& action);
     bool pop_input(int userId, std::string& out);
@@ -12,6 +12,8 @@ int main(int argc, char** argv) {
     int roomId = 0;
     std::string token;
     int p1 = -1, p2 = -1;
+    uint16_t lobbyPort = 0;         // optional: where to report the results
+    std::string reportToken;
 
     for (int i = 1; i + 1 < argc; i += 2) {
         std::string k = argv[i];
@@ -21,6 +23,8 @@ int main(int argc, char** argv) {
         else if (k == "--token") token = v;
         else if (k == "--p1") p1 = std::stoi(v);
         else if (k == "--p2") p2 = std::stoi(v);
+        else if (k == "--lobby-port") lobbyPort = static_cast<uint16_t>(std::stoi(v));
+        else if (k == "--report-token") reportToken = v;
     }
 
     if (!port || !roomId || token.empty() || p1 < 0 || p2 < 0) {
@@ -30,6 +34,7 @@ int main(int argc, char** argv) {
 
     std::vector<int> players = {p1, p2};
     GameServer gs(port, roomId, token, players);
+    if (lobbyPort && !reportToken.empty()) gs.report_results_to(lobbyPort, reportToken);
     gs.run();
     return 0;
 }
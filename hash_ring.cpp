@@ -0,0 +1,29 @@
+#include "hash_ring.hpp"
+
+// FNV-1a followed by a splitmix64 finalizer: FNV alone clusters keys that
+// differ only in their last characters, such as sequential ids.
+uint64_t HashRing::hash(const std::string& key) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char ch : key) {
+        h ^= ch;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+void HashRing::add(size_t node, const std::string& name) {
+    for (size_t i = 0; i < vnodes; ++i) {
+        points[hash(name + "#" + std::to_string(i))] = node;
+    }
+}
+
+size_t HashRing::owner(const std::string& key) const {
+    auto it = points.lower_bound(hash(key));
+    if (it == points.end()) it = points.begin();
+    return it->second;
+}
@@ -0,0 +1,26 @@
+#ifndef HASH_RING_HPP
+#define HASH_RING_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Consistent-hash ring. Every node is placed at several pseudo-random
+// points (virtual nodes); a key belongs to the first point at or after its
+// hash. Adding a node only moves the keys that land on its new points.
+class HashRing {
+public:
+    explicit HashRing(size_t vnodesPerNode = 64) : vnodes(vnodesPerNode) {}
+
+    void add(size_t node, const std::string& name);
+    size_t owner(const std::string& key) const;     // ring must not be empty
+    bool empty() const { return points.empty(); }
+
+    static uint64_t hash(const std::string& key);
+
+private:
+    size_t vnodes;
+    std::map<uint64_t, size_t> points;  // ring position -> node index
+};
+
+#endif
@@ -1,17 +1,73 @@
 #include "lobby_server.hpp"
+#include "embedded_db_client.hpp"
+#include "cluster_db_client.hpp"
+#include "db_client_pool.hpp"
 #include <iostream>
+#include <sstream>
 
-int main() {
+int main(int argc, char** argv) {
     constexpr uint16_t LOBBY_PORT = 13000;
 
-    constexpr const char* DB_HOST = "127.0.0.1";
-    constexpr uint16_t    DB_PORT = 12000;
+    std::string dbMode  = "tcp";        // tcp | embedded | cluster
+    std::string dbHost  = "127.0.0.1";
+    uint16_t    dbPort  = 12000;
+    std::string dataDir = "db";
+    size_t      dbPool  = 4;            // TCP connections to the DB
+    size_t      nearCacheBytes = 0;     // 0 = no client-side read cache
+    std::vector<std::string> dbNodes;   // cluster mode: host:port,...
+    std::string io      = "epoll";      // epoll | uring (falls back to epoll)
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string k = argv[i];
+        std::string v = argv[i+1];
+        if (k == "--db") dbMode = v;
+        else if (k == "--db-host") dbHost = v;
+        else if (k == "--db-port") dbPort = static_cast<uint16_t>(std::stoi(v));
+        else if (k == "--data-dir") dataDir = v;
+        else if (k == "--db-pool") dbPool = std::stoul(v);
+        else if (k == "--db-near-cache") nearCacheBytes = std::stoul(v);
+        else if (k == "--io") io = v;
+        else if (k == "--db-nodes") {
+            std::stringstream ss(v);
+            std::string node;
+            while (std::getline(ss, node, ',')) {
+                if (!node.empty()) dbNodes.push_back(node);
+            }
+        }
+    }
 
     try {
-        LobbyServer lobby(LOBBY_PORT, DB_HOST, DB_PORT);
-        std::cout << "[Lobby] Starting on port " << LOBBY_PORT
-                  << " (DB: " << DB_HOST << ":" << DB_PORT << ")"
-                  << std::endl;
+        std::unique_ptr<DbBackend> db;
+        if (dbMode == "embedded") {
+            db = std::make_unique<EmbeddedDbClient>(dataDir);
+        } else if (dbMode == "tcp") {
+            auto pool = std::make_unique<DbClientPool>(dbHost, dbPort, dbPool);
+            if (nearCacheBytes) pool->enable_near_cache(nearCacheBytes);
+            db = std::move(pool);
+        } else if (dbMode == "cluster") {
+            db = std::make_unique<ClusterDbClient>(dbNodes, dbPool);
+        } else {
+            std::cerr << "[Lobby] unknown --db mode: " << dbMode << std::endl;
+            return 1;
+        }
+
+        if (io != "epoll" && io != "uring") {
+            std::cerr << "[Lobby] unknown --io backend: " << io << std::endl;
+            return 1;
+        }
+
+        LobbyServer lobby(LOBBY_PORT, std::move(db));
+        if (io == "uring") lobby.set_io_backend(Reactor::Backend::IoUring);
+        std::cout << "[Lobby] Starting on port " << LOBBY_PORT;
+        if (dbMode == "embedded")
+            std::cout << " (DB: embedded, " << dataDir << ")";
+        else if (dbMode == "cluster")
+            std::cout << " (DB: cluster of " << dbNodes.size() << " nodes, "
+                      << dbPool << " connections each)";
+        else
+            std::cout << " (DB: " << dbHost << ":" << dbPort
+                      << ", " << dbPool << " connections)";
+        std::cout << std::endl;
         lobby.run(); 
     } catch (const std::exception& e) {
         std::cerr << "[Lobby] Fatal error: " << e.what() << std::endl;
@@ -0,0 +1,60 @@
+#include "db_plugin.hpp"
+#include <algorithm>
+using nlohmann::json;
+
+// Room membership changes as single atomic calls, the same rules the
+// lobby applies to its in-memory rooms:
+//   {"action":"call","procedure":"joinRoom","data":{"roomId":1,"userId":7}}
+//   {"action":"call","procedure":"leaveRoom","data":{"roomId":1,"userId":7}}
+
+static constexpr int kRoomCapacity = 2;
+
+static json error(const std::string& message) {
+    return {{"status","error"},{"message",message}};
+}
+
+// args: roomId, userId, optional capacity. Returns the room's players.
+static json join_room(ProcedureContext& db, const json& args) {
+    int roomId = args.value("roomId", 0);
+    int userId = args.value("userId", 0);
+    int capacity = args.value("capacity", kRoomCapacity);
+    if (roomId == 0 || userId == 0) return error("missing roomId/userId");
+
+    json room = db.read("Room", {{"id", roomId}})["data"];
+    if (!room.is_object()) return error("room not found");
+    json players = room.value("players", json::array());
+    if (std::find(players.begin(), players.end(), json(userId)) != players.end())
+        return {{"players", players}};
+    if (room.value("status", "idle") != "idle") return error("room is playing");
+    if (static_cast<int>(players.size()) >= capacity) return error("room full");
+
+    players.push_back(userId);
+    json r = db.update("Room", {{"id", roomId}}, {{"players", players}});
+    if (r.value("status", "") != "ok") return r;
+    return {{"players", players}};
+}
+
+// args: roomId, userId. The room goes away with its host or last player.
+static json leave_room(ProcedureContext& db, const json& args) {
+    int roomId = args.value("roomId", 0);
+    int userId = args.value("userId", 0);
+    if (roomId == 0 || userId == 0) return error("missing roomId/userId");
+
+    json room = db.read("Room", {{"id", roomId}})["data"];
+    if (!room.is_object()) return error("room not found");
+    json players = room.value("players", json::array());
+    players.erase(std::remove(players.begin(), players.end(), json(userId)), players.end());
+
+    json r = players.empty() || room.value("hostUserId", 0) == userId
+                 ? db.del("Room", {{"id", roomId}})
+                 : db.update("Room", {{"id", roomId}}, {{"players", players}});
+    if (r.value("status", "") != "ok") return r;
+    return {{"roomDeleted", r.contains("deleted")}};
+}
+
+DB_PLUGIN_EXPORT int db_plugin_abi() { return DB_PLUGIN_ABI; }
+
+DB_PLUGIN_EXPORT void db_plugin_register(ProcedureRegistry& registry) {
+    registry.add("joinRoom", join_room);
+    registry.add("leaveRoom", leave_room);
+}
@@ -4,14 +4,13 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <future>
 #include <unistd.h> 
 
 using nlohmann::json;
 
-LobbyServer::LobbyServer(uint16_t p,
-                         const std::string& dbHost,
-                         uint16_t dbPort)
-    : port(p), db(dbHost, dbPort) {}
+LobbyServer::LobbyServer(uint16_t p, std::unique_ptr<DbBackend> backend)
+    : port(p), db(std::move(backend)) {}
 
 // ============ utility ============
 
@@ -24,8 +23,15 @@ std::string LobbyServer::gen_session_id() {
 }
 
 int LobbyServer::gen_room_id() {
-    static int nextId = 1;
-    return nextId++;
+    std::lock_guard<std::mutex> lock(roomIdMtx);
+    if (nextRoomId == roomIdEnd) {
+        json r = db->reserve_ids("Room", kRoomIdBlock);
+        if (r.value("status", "") != "ok")
+            throw std::runtime_error("cannot reserve room ids: " + r.value("message", r.dump()));
+        nextRoomId = r["first"].get<int>();
+        roomIdEnd = nextRoomId + r["count"].get<int>();
+    }
+    return nextRoomId++;
 }
 
 std::string LobbyServer::gen_token(int len) {
@@ -66,6 +72,8 @@ void LobbyServer::cleanup_session_by_fd(int fd) {
     if (deadUserId != -1) {
         userIdToSession.erase(deadUserId);
 
+        // Issue all room writes at once and wait for them together.
+        std::vector<std::future<json>> pending;
         for (auto it = rooms.begin(); it != rooms.end(); ) {
             RoomState& r = it->second;
             bool changed = false;
@@ -78,14 +86,15 @@ void LobbyServer::cleanup_session_by_fd(int fd) {
 
             if (r.players.empty() || r.hostUserId == deadUserId) {
                 int roomId = r.roomId;
-                db.del("Room", {{"id", roomId}});
+                pending.push_back(db->del_async("Room", {{"id", roomId}}));
                 it = rooms.erase(it);
                 continue;
             } else if (changed) {
-                db.update("Room", {{"id", r.roomId}}, {{"players", r.players}});
+                pending.push_back(db->update_async("Room", {{"id", r.roomId}}, {{"players", r.players}}));
             }
             ++it;
         }
+        for (auto& f : pending) f.wait();
     }
 }
 
@@ -104,11 +113,7 @@ void LobbyServer::push_message_to_user(int userId, const json& msg) {
     const std::string& sid = itS->second;
     auto it = sessions.find(sid);
     if (it == sessions.end()) return;
-    int fd = it->second.fd;
-    try {
-        send_json(fd, msg);
-    } catch (...) {
-    }
+    reactor->send(it->second.fd, msg.dump());
 }
 
 // ============ handlers: auth ============
@@ -121,7 +126,7 @@ json LobbyServer::handle_register(const json& msg) {
         return {{"type","REGISTER_FAIL"},{"reason","missing name/password"}};
     }
 
-    json r = db.read("User", {{"name", name}});
+    json r = db->read("User", {{"name", name}});
     if (r["status"] == "ok" && !r["data"].is_null()) {
         return {{"type","REGISTER_FAIL"},{"reason","name taken"}};
     }
@@ -133,7 +138,7 @@ json LobbyServer::handle_register(const json& msg) {
         {"createdAt", (long long)std::time(nullptr)},
         {"lastLoginAt", nullptr}
     };
-    json cr = db.create("User", user);
+    json cr = db->create("User", user);
     if (cr["status"] != "ok") {
         return {{"type","REGISTER_FAIL"},{"reason","db error"}};
     }
@@ -147,7 +152,7 @@ json LobbyServer::handle_login(const json& msg, int clientFd) {
         return {{"type","LOGIN_FAIL"},{"reason","missing name/password"}};
     }
 
-    json r = db.read("User", {{"name", name}});
+    json r = db->read("User", {{"name", name}});
     if (r["status"] != "ok" || r["data"].is_null()) {
         return {{"type","LOGIN_FAIL"},{"reason","no such user"}};
     }
@@ -168,8 +173,10 @@ json LobbyServer::handle_login(const json& msg, int clientFd) {
             };
         }
 
-        db.update("User", {{"id", userId}},
-                {{"lastLoginAt", (long long)std::time(nullptr)}});
+        // Nobody waits on this write; let it complete in the background.
+        db->update_async("User", {{"id", userId}},
+                {{"lastLoginAt", (long long)std::time(nullptr)}},
+                [](json) {});
 
         std::string sessionId = gen_session_id();
         SessionInfo s{userId, name, clientFd};
@@ -197,6 +204,7 @@ json LobbyServer::handle_logout(const json& msg) {
     sessions.erase(it);
     userIdToSession.erase(uid);
 
+    std::vector<std::future<json>> pending;
     for (auto rIt = rooms.begin(); rIt != rooms.end(); ) {
         RoomState& r = rIt->second;
         bool changed = false;
@@ -209,14 +217,15 @@ json LobbyServer::handle_logout(const json& msg) {
 
         if (r.players.empty() || r.hostUserId == uid) {
             int roomId = r.roomId;
-            db.del("Room", {{"id", roomId}});
+            pending.push_back(db->del_async("Room", {{"id", roomId}}));
             rIt = rooms.erase(rIt);
             continue;
         } else if (changed) {
-            db.update("Room", {{"id", r.roomId}}, {{"players", r.players}});
+            pending.push_back(db->update_async("Room", {{"id", r.roomId}}, {{"players", r.players}}));
         }
         ++rIt;
     }
+    for (auto& f : pending) f.wait();
 
     return {{"type","LOGOUT_OK"}};
 }
@@ -245,19 +254,71 @@ json LobbyServer::handle_list_rooms(const json& msg) {
         return {{"type","ERROR"},{"reason","invalid session"}};
     }
 
+    json arr = json::array();
+    json userIds = json::array();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& [rid, r] : rooms) {
+            arr.push_back({
+                {"id", r.roomId},
+                {"name", r.name},
+                {"hostUserId", r.hostUserId},
+                {"visibility", r.visibility},
+                {"status", r.status},
+                {"players", r.players}
+            });
+            for (int uid : r.players) userIds.push_back(uid);
+        }
+    }
+
+    // Every player's name in one DB round trip rather than one per player.
+    std::unordered_map<int, std::string> names;
+    if (!userIds.empty()) {
+        json r = db->mget("User", userIds);
+        if (r["status"] == "ok") {
+            for (auto& u : r["items"]) {
+                if (u.is_object()) names[u["id"].get<int>()] = u.value("name", "");
+            }
+        }
+    }
+    for (auto& room : arr) {
+        json playerNames = json::array();
+        for (auto& uid : room["players"]) playerNames.push_back(names[uid.get<int>()]);
+        room["playerNames"] = playerNames;
+    }
+    return {{"type","ROOMS"},{"rooms",arr}};
+}
+
+json LobbyServer::handle_find_users(const json& msg) {
+    std::string sessionId = msg.value("sessionId", "");
+    SessionInfo me;
+    if (!check_session(sessionId, me)) {
+        return {{"type","ERROR"},{"reason","invalid session"}};
+    }
+
+    std::string prefix = msg.value("prefix", "");
+    if (prefix.empty()) {
+        return {{"type","ERROR"},{"reason","missing prefix"}};
+    }
+
+    json r = db->query("User",
+                       {{"name", {{"$prefix", prefix}, {"$caseFold", true}}}},
+                       {{"limit", 10}});
+    if (r["status"] != "ok") {
+        return {{"type","ERROR"},{"reason","db error"}};
+    }
+
     json arr = json::array();
     std::lock_guard<std::mutex> lock(mtx);
-    for (auto& [rid, r] : rooms) {
+    for (auto& u : r["items"]) {
+        int uid = u["id"].get<int>();
         arr.push_back({
-            {"id", r.roomId},
-            {"name", r.name},
-            {"hostUserId", r.hostUserId},
-            {"visibility", r.visibility},
-            {"status", r.status},
-            {"players", r.players}
+            {"userId", uid},
+            {"name", u.value("name", "")},
+            {"online", userIdToSession.count(uid) > 0}
         });
     }
-    return {{"type","ROOMS"},{"rooms",arr}};
+    return {{"type","USERS_FOUND"},{"users",arr}};
 }
 
 // ============ handlers: rooms ============
@@ -272,7 +333,13 @@ json LobbyServer::handle_create_room(const json& msg) {
     std::string name = msg.value("name", me.name + "'s room");
     std::string visibility = msg.value("visibility", "public");
 
-    int roomId = gen_room_id();
+    int roomId;
+    try {
+        roomId = gen_room_id();
+    } catch (const std::exception& e) {
+        std::cerr << "[Lobby] " << e.what() << "\n";
+        return {{"type","ERROR"},{"reason","db error"}};
+    }
 
     RoomState rs;
     rs.roomId = roomId;
@@ -296,7 +363,7 @@ json LobbyServer::handle_create_room(const json& msg) {
         {"players", rs.players},
         {"createdAt", (long long)std::time(nullptr)}
     };
-    db.create("Room", roomDoc);
+    db->create("Room", roomDoc);
 
     return {{"type","CREATE_ROOM_OK"},{"roomId",roomId}};
 }
@@ -330,7 +397,7 @@ json LobbyServer::handle_join_room(const json& msg) {
         r.players.push_back(me.userId);
     }
 
-    db.update("Room", {{"id", roomId}}, {{"players", r.players}});
+    db->update("Room", {{"id", roomId}}, {{"players", r.players}});
     return {
         {"type","JOIN_ROOM_OK"},
         {"roomId",roomId},
@@ -360,10 +427,10 @@ json LobbyServer::handle_leave_room(const json& msg) {
 
     if (r.players.empty() || me.userId == r.hostUserId) {
         rooms.erase(it);
-        db.del("Room", {{"id", roomId}});
+        db->del("Room", {{"id", roomId}});
         return {{"type","LEAVE_ROOM_OK"},{"roomDeleted",true}};
     } else {
-        db.update("Room", {{"id", roomId}}, {{"players", r.players}});
+        db->update("Room", {{"id", roomId}}, {{"players", r.players}});
         return {{"type","LEAVE_ROOM_OK"},{"roomDeleted",false}};
     }
 }
@@ -479,7 +546,7 @@ json LobbyServer::handle_accept_invite(const json& msg) {
         invitesByUser.erase(itInv);
     }
 
-    db.update("Room", {{"id", roomId}}, {{"players", r.players}});
+    db->update("Room", {{"id", roomId}}, {{"players", r.players}});
 
     return {
         {"type","JOIN_ROOM_OK"},
@@ -504,6 +571,7 @@ json LobbyServer::handle_start_game(const json& msg) {
     }
 
     int p1 = -1, p2 = -1;
+    RoomState started;
 
     {
         std::lock_guard<std::mutex> lock(mtx);
@@ -527,11 +595,13 @@ json LobbyServer::handle_start_game(const json& msg) {
         p2 = r.players[1];
 
         r.status = "playing";
-        db.update("Room", {{"id", roomId}}, {{"status","playing"}});
+        started = r;
+        db->update("Room", {{"id", roomId}}, {{"status","playing"}});
     }
 
     int gamePort = allocate_game_port();
     std::string roomToken = gen_token(32);
+    std::string reportToken = gen_token(32);    // game_server -> lobby only
     std::string gameHost = "140.113.17.14";
 
     pid_t pid = fork();
@@ -540,6 +610,7 @@ json LobbyServer::handle_start_game(const json& msg) {
         std::string roomIdStr = std::to_string(roomId);
         std::string p1Str     = std::to_string(p1);
         std::string p2Str     = std::to_string(p2);
+        std::string lobbyStr  = std::to_string(port);
 
         execlp("./game_server", "game_server",
                "--port",  portStr.c_str(),
@@ -547,6 +618,8 @@ json LobbyServer::handle_start_game(const json& msg) {
                "--token", roomToken.c_str(),
                "--p1",    p1Str.c_str(),
                "--p2",    p2Str.c_str(),
+               "--lobby-port",   lobbyStr.c_str(),
+               "--report-token", reportToken.c_str(),
                (char*)nullptr);
 
         std::perror("[Lobby] execlp game_server failed");
@@ -557,7 +630,7 @@ json LobbyServer::handle_start_game(const json& msg) {
         auto it = rooms.find(roomId);
         if (it != rooms.end()) {
             it->second.status = "idle";
-            db.update("Room", {{"id", roomId}}, {{"status","idle"}});
+            db->update("Room", {{"id", roomId}}, {{"status","idle"}});
         }
         return {{"type","ERROR"},{"reason","failed to start game server"}};
     }
@@ -573,6 +646,7 @@ json LobbyServer::handle_start_game(const json& msg) {
     {
         std::lock_guard<std::mutex> lock(mtx);
         gameLaunchByRoom[roomId] = gameStart;
+        pendingReports[roomId] = {reportToken, started};
     }
 
     return gameStart;
@@ -612,6 +686,34 @@ json LobbyServer::handle_get_game_start(const json& msg) {
     return itLaunch->second;
 }
 
+// One record per player, so a player's history is a plain filter on userId.
+static json match_history_records(const RoomState& r, const json& results) {
+    int64_t endedAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    json records = json::array();
+    for (auto& res : results) {
+        if (!res.is_object()) continue;
+        int uid = res.value("userId", -1);
+        if (std::find(r.players.begin(), r.players.end(), uid) == r.players.end()) continue;
+
+        int opponent = -1;
+        for (int p : r.players) {
+            if (p != uid) opponent = p;
+        }
+        records.push_back({
+            {"userId", uid},
+            {"opponentId", opponent},
+            {"roomId", r.roomId},
+            {"score", res.value("score", 0)},
+            {"lines", res.value("lines", 0)},
+            {"win", res.value("win", false)},
+            {"endedAt", endedAt}
+        });
+    }
+    return records;
+}
+
 nlohmann::json LobbyServer::handle_game_finished(const nlohmann::json& msg) {
     std::string sessionId = msg.value("sessionId", "");
     int roomId = msg.value("roomId", 0);
@@ -625,77 +727,141 @@ nlohmann::json LobbyServer::handle_game_finished(const nlohmann::json& msg) {
         return {{"type","ERROR"}, {"reason","invalid session"}};
     }
 
-    std::lock_guard<std::mutex> lock(mtx);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
 
-    auto it = rooms.find(roomId);
-    if (it == rooms.end()) {
-        return {{"type","ERROR"}, {"reason","no such room"}};
-    }
+        auto it = rooms.find(roomId);
+        if (it == rooms.end()) {
+            return {{"type","ERROR"}, {"reason","no such room"}};
+        }
 
-    RoomState& r = it->second;
+        RoomState& r = it->second;
 
-    if (std::find(r.players.begin(), r.players.end(), me.userId) == r.players.end()) {
-        return {{"type","ERROR"}, {"reason","not in room"}};
+        if (std::find(r.players.begin(), r.players.end(), me.userId) == r.players.end()) {
+            return {{"type","ERROR"}, {"reason","not in room"}};
+        }
+
+        // Results come from the game server (GAME_RESULT), never from the
+        // players, so a client cannot record a win for itself.
+        r.status = "idle";
+        gameLaunchByRoom.erase(roomId);
+
+        try {
+            db->update("Room", {{"id", roomId}}, {{"status","idle"}});
+        } catch (...) {
+        }
     }
 
+    return {{"type","OK"}};
+}
 
-    r.status = "idle";
-    gameLaunchByRoom.erase(roomId);
+// From the game_server this lobby started for the room: the GAME_OVER
+// results, once per game, authenticated by the report token only it got.
+json LobbyServer::handle_game_result(const json& msg) {
+    int roomId = msg.value("roomId", 0);
+    std::string token = msg.value("reportToken", "");
 
-    try {
-        db.update("Room", {{"id", roomId}}, {{"status","idle"}});
-    } catch (...) {
+    json history = json::array();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = pendingReports.find(roomId);
+        if (it == pendingReports.end() || token.empty() || it->second.token != token) {
+            return {{"type","ERROR"}, {"reason","invalid report token"}};
+        }
+        if (msg.contains("results") && msg["results"].is_array()) {
+            history = match_history_records(it->second.room, msg["results"]);
+        }
+        pendingReports.erase(it);
+    }
+
+    if (!history.empty()) {
+        try {
+            db->append("MatchHistory", history);
+        } catch (...) {
+        }
     }
 
     return {{"type","OK"}};
 }
 
+json LobbyServer::handle_match_history(const json& msg) {
+    std::string sessionId = msg.value("sessionId", "");
+    SessionInfo me;
+    if (!check_session(sessionId, me)) {
+        return {{"type","ERROR"},{"reason","invalid session"}};
+    }
+
+    int userId = msg.value("userId", me.userId);
+    int limit = std::clamp(msg.value("limit", 10), 1, 100);
+    json filter = {{"userId", userId}};
+    if (msg.contains("sinceMs") && msg["sinceMs"].is_number()) {
+        filter["endedAt"] = {{"$gte", msg["sinceMs"]}};
+    }
+
+    json r = db->query("MatchHistory", filter, {{"limit", limit}, {"desc", true}});
+    if (r["status"] != "ok") {
+        return {{"type","ERROR"},{"reason","db error"}};
+    }
+    json resp = {{"type","MATCH_HISTORY"},{"userId",userId},{"matches",r["items"]}};
+    json stats = db->read("PlayerStats", {{"userId", userId}});
+    if (stats["status"] == "ok" && stats["data"].is_object()) {
+        resp["played"] = stats["data"]["played"];
+        resp["won"] = stats["data"]["won"];
+    }
+    return resp;
+}
+
 
 
 // ============ connection handling ============
 
-void LobbyServer::handle_client(TcpSocket client) {
-    int fd = client.fd();
-    try {
-        while (true) {
-            json msg = recv_json(fd);
-            std::string type = msg.value("type", "");
-            json resp;
-
-            if      (type == "REGISTER")       resp = handle_register(msg);
-            else if (type == "LOGIN")          resp = handle_login(msg, fd);
-            else if (type == "LOGOUT")         resp = handle_logout(msg);
-            else if (type == "LIST_USERS")     resp = handle_list_users(msg);
-            else if (type == "LIST_ROOMS")     resp = handle_list_rooms(msg);
-            else if (type == "CREATE_ROOM")    resp = handle_create_room(msg);
-            else if (type == "JOIN_ROOM")      resp = handle_join_room(msg);
-            else if (type == "LEAVE_ROOM")     resp = handle_leave_room(msg);
-            else if (type == "LIST_INVITES")   resp = handle_list_invites(msg);
-            else if (type == "ACCEPT_INVITE")  resp = handle_accept_invite(msg);
-            else if (type == "INVITE")         resp = handle_invite(msg);
-            else if (type == "START_GAME")     resp = handle_start_game(msg);
-            else if (type == "GET_GAME_START") resp = handle_get_game_start(msg);
-            else if (type == "GAME_FINISHED")  resp = handle_game_finished(msg);
-            else                               resp = {{"type","ERROR"},{"reason","unknown type"}};
-            send_json(fd, resp);
-        }
-    } catch (const std::exception& e) {
-        cleanup_session_by_fd(fd);
-        // std::cerr << "[Lobby] client disconnected: " << e.what() << "\n";
-    }
+void LobbyServer::handle_frame(int fd, const std::string& body) {
+    json msg = json::parse(body);
+    std::string type = msg.value("type", "");
+    json resp;
+
+    if      (type == "REGISTER")       resp = handle_register(msg);
+    else if (type == "LOGIN")          resp = handle_login(msg, fd);
+    else if (type == "LOGOUT")         resp = handle_logout(msg);
+    else if (type == "LIST_USERS")     resp = handle_list_users(msg);
+    else if (type == "LIST_ROOMS")     resp = handle_list_rooms(msg);
+    else if (type == "FIND_USERS")     resp = handle_find_users(msg);
+    else if (type == "CREATE_ROOM")    resp = handle_create_room(msg);
+    else if (type == "JOIN_ROOM")      resp = handle_join_room(msg);
+    else if (type == "LEAVE_ROOM")     resp = handle_leave_room(msg);
+    else if (type == "LIST_INVITES")   resp = handle_list_invites(msg);
+    else if (type == "ACCEPT_INVITE")  resp = handle_accept_invite(msg);
+    else if (type == "INVITE")         resp = handle_invite(msg);
+    else if (type == "START_GAME")     resp = handle_start_game(msg);
+    else if (type == "GET_GAME_START") resp = handle_get_game_start(msg);
+    else if (type == "GAME_FINISHED")  resp = handle_game_finished(msg);
+    else if (type == "GAME_RESULT")    resp = handle_game_result(msg);
+    else if (type == "MATCH_HISTORY")  resp = handle_match_history(msg);
+    else                               resp = {{"type","ERROR"},{"reason","unknown type"}};
+    if (!reactor->send(fd, resp.dump())) reactor->close(fd);
 }
 
 void LobbyServer::run() {
-    TcpSocket listener;
-    listener.bind_and_listen(port);
-    std::cout << "[Lobby] Listening on port " << port << "\n";
+    // Name lookups (login, register, invite search) go through this index.
+    db->create_index("User", {{"field","name"},{"type","prefix"},{"caseFold",true}});
+    db->create_time_series("MatchHistory", {{"timeField","endedAt"}});
+    // Per-player totals, kept current as matches are appended.
+    db->create_view("PlayerStats", {
+        {"source","MatchHistory"},
+        {"groupBy","userId"},
+        {"aggregates", {{"played", {{"$count", json::object()}}},
+                        {"won", {{"$sum","win"}}},
+                        {"avgScore", {{"$avg","score"}}}}}
+    });
+
+    // Handlers block on database round trips, so the reactor gets a few
+    // more workers than cores.
+    Reactor::Handlers handlers;
+    handlers.on_frame = [this](int conn, std::string body) { handle_frame(conn, body); };
+    handlers.on_close = [this](int conn) { cleanup_session_by_fd(conn); };
+    reactor = std::make_unique<Reactor>(std::max(4u, 2 * std::thread::hardware_concurrency()),
+                                        std::move(handlers), ioBackend);
 
-    while (true) {
-        try {
-            TcpSocket client = listener.accept_conn();
-            std::thread(&LobbyServer::handle_client, this, std::move(client)).detach();
-        } catch (const std::exception& e) {
-            std::cerr << "[Lobby] accept error: " << e.what() << "\n";
-        }
-    }
+    std::cout << "[Lobby] Listening on port " << port << "\n";
+    reactor->run(port);
 }
@@ -5,6 +5,7 @@
 #include "db_client.hpp"
 #include "json.hpp"
 #include <unordered_map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <string>
@@ -13,7 +14,7 @@
 struct SessionInfo {
     int userId;
     std::string name;
-    int fd; 
+    int fd;                 // reactor connection
 };
 
 
@@ -26,6 +27,13 @@ struct RoomState {
     std::vector<int> players; 
 };
 
+// A game in progress: the secret its game_server reports results with,
+// and the room as it was when the game started.
+struct GameReport {
+    std::string token;
+    RoomState room;
+};
+
 struct Invite {
     int roomId;
     int fromUserId;
@@ -34,15 +42,18 @@ struct Invite {
 
 class LobbyServer {
 public:
-    LobbyServer(uint16_t port,
-                const std::string& dbHost,
-                uint16_t dbPort);
+    LobbyServer(uint16_t port, std::unique_ptr<DbBackend> db);
+
+    // epoll by default; see Reactor::Backend. Set before run().
+    void set_io_backend(Reactor::Backend backend) { ioBackend = backend; }
 
     void run(); 
 
 private:
     uint16_t port;
-    DbClient db;
+    std::unique_ptr<DbBackend> db;
+    Reactor::Backend ioBackend = Reactor::Backend::Epoll;
+    std::unique_ptr<Reactor> reactor;
     std::mutex mtx;
 
     std::unordered_map<std::string, SessionInfo> sessions;   // sessionId -> info
@@ -50,12 +61,21 @@ private:
     std::unordered_map<int, std::string> userIdToSession;    // userId -> sessionId
     std::unordered_map<int, std::vector<Invite>> invitesByUser; // targetUserId -> invites
     std::unordered_map<int, nlohmann::json> gameLaunchByRoom; // roomId -> GAME_START msg
+    std::unordered_map<int, GameReport> pendingReports;       // roomId -> game awaiting results
 
     int nextGamePort = 20000; 
 
-    void handle_client(TcpSocket client);
+    // Room ids come from blocks leased off the Room collection's id
+    // sequence, so they never collide with rooms created by an earlier
+    // run; one reserveIds round trip per block.
+    static constexpr int kRoomIdBlock = 64;
+    std::mutex roomIdMtx;
+    int nextRoomId = 0;
+    int roomIdEnd = 0;          // nextRoomId == roomIdEnd: block used up
+
+    void handle_frame(int conn, const std::string& body);
     std::string gen_session_id();
-    int gen_room_id();
+    int gen_room_id();          // throws std::runtime_error if no block can be leased
     std::string gen_token(int len = 32);
 
     bool check_session(const std::string& sessionId, SessionInfo& out);
@@ -67,6 +87,7 @@ private:
     nlohmann::json handle_logout(const nlohmann::json& msg);           
     nlohmann::json handle_list_users(const nlohmann::json& msg);
     nlohmann::json handle_list_rooms(const nlohmann::json& msg);
+    nlohmann::json handle_find_users(const nlohmann::json& msg);
     nlohmann::json handle_create_room(const nlohmann::json& msg);
     nlohmann::json handle_join_room(const nlohmann::json& msg);
     nlohmann::json handle_leave_room(const nlohmann::json& msg);
@@ -77,6 +98,8 @@ private:
     nlohmann::json handle_start_game(const nlohmann::json& msg);        
     nlohmann::json handle_get_game_start(const nlohmann::json& msg);
     nlohmann::json handle_game_finished(const nlohmann::json& msg);
+    nlohmann::json handle_game_result(const nlohmann::json& msg);
+    nlohmann::json handle_match_history(const nlohmann::json& msg);
 
     void push_message_to_user(int userId, const nlohmann::json& msg);
 };
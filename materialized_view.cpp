@@ -0,0 +1,115 @@
+#include "materialized_view.hpp"
+#include <cmath>
+#include <stdexcept>
+
+using nlohmann::json;
+
+MaterializedView::MaterializedView(const json& spec)
+    : m_spec(spec), m_source(spec["source"].get<std::string>()),
+      filter(spec.value("filter", json::object())) {}
+
+MaterializedView MaterializedView::from_spec(const json& spec) {
+    if (!spec.is_object() || !spec.contains("source") || !spec["source"].is_string()
+        || spec["source"].get<std::string>().empty())
+        throw std::invalid_argument("view spec needs a source");
+    if (spec.contains("filter") && !spec["filter"].is_object())
+        throw std::invalid_argument("view filter must be object");
+
+    MaterializedView v(spec);
+
+    json groupBy = spec.value("groupBy", json::array());
+    if (groupBy.is_string()) groupBy = json::array({groupBy});
+    if (!groupBy.is_array())
+        throw std::invalid_argument("groupBy must be a field or an array of fields");
+    for (const auto& f : groupBy) {
+        if (!f.is_string() || f.get<std::string>().empty())
+            throw std::invalid_argument("groupBy must be a field or an array of fields");
+        v.groupFields.push_back(f.get<std::string>());
+        v.groupPaths.emplace_back(f.get<std::string>());
+    }
+
+    json aggs = spec.value("aggregates", json::object());
+    if (!aggs.is_object() || aggs.empty())
+        throw std::invalid_argument("view needs at least one aggregate");
+    for (auto it = aggs.begin(); it != aggs.end(); ++it) {
+        const json& a = it.value();
+        if (!a.is_object() || a.size() != 1)
+            throw std::invalid_argument("aggregate " + it.key() + " must be {\"$op\": ...}");
+        const std::string& op = a.begin().key();
+        const json& arg = a.begin().value();
+        if (op == "$count") {
+            v.aggregates.push_back({it.key(), Op::Count, FieldPath()});
+        } else if ((op == "$sum" || op == "$avg") && arg.is_string() && !arg.get<std::string>().empty()) {
+            v.aggregates.push_back({it.key(), op == "$sum" ? Op::Sum : Op::Avg,
+                                    FieldPath(arg.get<std::string>())});
+        } else {
+            throw std::invalid_argument("aggregate " + it.key() + ": use $count, or $sum/$avg of a field");
+        }
+    }
+    return v;
+}
+
+void MaterializedView::apply(const json* before, const json* after) {
+    if (before && filter.matches(*before)) add(*before, -1);
+    if (after && filter.matches(*after)) add(*after, +1);
+}
+
+void MaterializedView::add(const json& doc, int sign) {
+    json key = json::object();
+    for (size_t i = 0; i < groupPaths.size(); ++i) {
+        const json* v = groupPaths[i].resolve(doc);
+        key[groupFields[i]] = v ? *v : json(nullptr);
+    }
+
+    auto it = groups.find(key.dump());
+    if (it == groups.end()) {
+        if (sign < 0) return;   // never counted
+        it = groups.emplace(key.dump(), Group{key, 0, std::vector<Accumulator>(aggregates.size())}).first;
+    }
+    Group& g = it->second;
+    g.docs += sign;
+    for (size_t i = 0; i < aggregates.size(); ++i) {
+        if (aggregates[i].op == Op::Count) continue;
+        const json* v = aggregates[i].field.resolve(doc);
+        if (!v || !(v->is_number() || v->is_boolean())) continue;
+        double x = v->is_boolean() ? (v->get<bool>() ? 1 : 0) : v->get<double>();
+        g.acc[i].sum += sign * x;
+        g.acc[i].n += sign;
+    }
+    if (g.docs <= 0) groups.erase(it);
+}
+
+// Whole sums print as integers, as the summed values most likely were.
+static json number_of(double x) {
+    if (std::isfinite(x) && x == std::trunc(x) && std::fabs(x) < 9.0e15) return static_cast<int64_t>(x);
+    return x;
+}
+
+json MaterializedView::row(const Group& g) const {
+    json r = g.key;
+    for (size_t i = 0; i < aggregates.size(); ++i) {
+        const Accumulator& a = g.acc[i];
+        switch (aggregates[i].op) {
+        case Op::Count: r[aggregates[i].name] = g.docs; break;
+        case Op::Sum:   r[aggregates[i].name] = number_of(a.sum); break;
+        case Op::Avg:   r[aggregates[i].name] = a.n ? json(a.sum / a.n) : json(nullptr); break;
+        }
+    }
+    return r;
+}
+
+std::vector<json> MaterializedView::rows(const json& rowFilter, size_t limit) const {
+    Predicate pred(rowFilter);
+    std::vector<json> out;
+    for (const auto& [k, g] : groups) {
+        json r = row(g);
+        if (!pred.matches(r)) continue;
+        out.push_back(std::move(r));
+        if (limit && out.size() >= limit) break;
+    }
+    return out;
+}
+
+json MaterializedView::stats() const {
+    return {{"type", "view"}, {"source", m_source}, {"groups", groups.size()}};
+}
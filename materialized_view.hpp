@@ -0,0 +1,76 @@
+#ifndef MATERIALIZED_VIEW_HPP
+#define MATERIALIZED_VIEW_HPP
+
+#include "db_filter.hpp"
+#include "db_index.hpp"
+#include "json.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Group-by aggregation over a source collection or time series, kept up to
+// date one document at a time: every change to the source takes the old
+// version's contribution out of its group and adds the new one's. Only
+// invertible aggregates are offered, so no change ever needs a rescan.
+//
+// Spec:
+//   {"source": "MatchHistory",
+//    "filter": {...},                      // optional; same as query filters
+//    "groupBy": "userId" | ["a", "b.c"],   // optional field paths
+//    "aggregates": {"played": {"$count": {}},
+//                   "won":    {"$sum": "win"},     // booleans count 0/1
+//                   "score":  {"$avg": "score"}}}
+//
+// Each group is one row: the groupBy fields under their own names plus
+// one member per aggregate. A group disappears when its last document
+// does.
+class MaterializedView {
+public:
+    // Throws std::invalid_argument on a bad spec.
+    static MaterializedView from_spec(const nlohmann::json& spec);
+
+    const nlohmann::json& spec() const { return m_spec; }
+    const std::string& source() const { return m_source; }
+
+    // One source document changed from before to after; either may be
+    // null (create / delete).
+    void apply(const nlohmann::json* before, const nlohmann::json* after);
+    void clear() { groups.clear(); }
+
+    // Rows matching filter in a stable order, at most limit (0 = all).
+    std::vector<nlohmann::json> rows(const nlohmann::json& filter, size_t limit) const;
+    size_t size() const { return groups.size(); }
+    nlohmann::json stats() const;
+
+private:
+    enum class Op { Count, Sum, Avg };
+    struct Aggregate {
+        std::string name;
+        Op op;
+        FieldPath field;        // Sum, Avg
+    };
+    struct Accumulator {
+        double sum = 0;
+        int64_t n = 0;          // documents with a numeric value
+    };
+    struct Group {
+        nlohmann::json key;     // groupBy field -> value
+        int64_t docs = 0;
+        std::vector<Accumulator> acc;
+    };
+
+    nlohmann::json m_spec;
+    std::string m_source;
+    Predicate filter;
+    std::vector<std::string> groupFields;
+    std::vector<FieldPath> groupPaths;
+    std::vector<Aggregate> aggregates;
+    std::map<std::string, Group> groups;    // by serialized key
+
+    explicit MaterializedView(const nlohmann::json& spec);
+    void add(const nlohmann::json& doc, int sign);
+    nlohmann::json row(const Group& g) const;
+};
+
+#endif
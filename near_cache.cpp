@@ -0,0 +1,93 @@
+#include "near_cache.hpp"
+#include <algorithm>
+
+using nlohmann::json;
+
+NearCache::NearCache(size_t cap) : maxBytes(cap) {}
+
+std::string NearCache::make_key(const std::string& coll, const json& filter) {
+    return coll + '\0' + filter.dump();
+}
+
+void NearCache::erase(std::list<Entry>::iterator it) {
+    bytes -= it->bytes;
+    index.erase(it->key);
+    lru.erase(it);
+}
+
+bool NearCache::get(const std::string& coll, const json& filter, json& out) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(make_key(coll, filter));
+    if (it == index.end()) {
+        ++misses;
+        return false;
+    }
+    if (it->second->expires <= Clock::now()) {
+        erase(it->second);
+        ++misses;
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    out = it->second->data;
+    ++hits;
+    return true;
+}
+
+uint64_t NearCache::epoch(const std::string& coll) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return epochs[coll];
+}
+
+void NearCache::put(const std::string& coll, const json& filter, const json& data,
+                    Clock::time_point expires, uint64_t epochAtSend) {
+    std::string key = make_key(coll, filter);
+    size_t size = key.size() + data.dump().size() + sizeof(Entry);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (epochs[coll] != epochAtSend || size > maxBytes) return;
+
+    auto it = index.find(key);
+    if (it != index.end()) erase(it->second);
+
+    int docId = -1;
+    if (data.is_object() && data.contains("id") && data["id"].is_number_integer())
+        docId = data["id"].get<int>();
+
+    lru.push_front({key, coll, data, docId, expires, size});
+    index[key] = lru.begin();
+    bytes += size;
+
+    while (bytes > maxBytes && !lru.empty()) {
+        erase(std::prev(lru.end()));
+        ++evictions;
+    }
+}
+
+void NearCache::invalidate(const std::string& coll, const std::vector<int>& ids) {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++epochs[coll];
+    for (auto it = lru.begin(); it != lru.end(); ) {
+        auto cur = it++;
+        if (cur->coll != coll) continue;
+        if (ids.empty() || cur->docId == -1
+            || std::find(ids.begin(), ids.end(), cur->docId) != ids.end()) {
+            erase(cur);
+            ++invalidations;
+        }
+    }
+}
+
+json NearCache::stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t lookups = hits + misses;
+    return {
+        {"maxBytes", maxBytes},
+        {"bytes", bytes},
+        {"entries", lru.size()},
+        {"hits", hits},
+        {"misses", misses},
+        {"evictions", evictions},
+        {"invalidations", invalidations},
+        {"hitRate", lookups ? (double)hits / (double)lookups : 0.0}
+    };
+}
@@ -0,0 +1,65 @@
+#ifndef NEAR_CACHE_HPP
+#define NEAR_CACHE_HPP
+
+#include "json.hpp"
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Client-side cache of point reads (collection + filter -> document).
+// An entry is only valid while the server-granted lease that filled it is
+// running; in the meantime the server pushes invalidations for the
+// collection, which drop the affected entries early. Bounded by an
+// approximate byte budget with LRU eviction.
+class NearCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit NearCache(size_t maxBytes);
+
+    bool get(const std::string& coll, const nlohmann::json& filter, nlohmann::json& out);
+
+    // Invalidation counter for a collection. Take it before sending a read
+    // and pass it to put(): if an invalidation arrived in between, the
+    // reply may predate it and is not cached.
+    uint64_t epoch(const std::string& coll);
+    void put(const std::string& coll, const nlohmann::json& filter, const nlohmann::json& data,
+             Clock::time_point expires, uint64_t epochAtSend);
+
+    // Drops entries for the given document ids plus all cached misses;
+    // an empty id list drops the whole collection.
+    void invalidate(const std::string& coll, const std::vector<int>& ids);
+
+    nlohmann::json stats();
+
+private:
+    struct Entry {
+        std::string key;
+        std::string coll;
+        nlohmann::json data;
+        int docId;              // -1 for a cached "no such document"
+        Clock::time_point expires;
+        size_t bytes;
+    };
+
+    std::mutex mtx;
+    size_t maxBytes;
+    size_t bytes = 0;
+    std::list<Entry> lru;       // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_map<std::string, uint64_t> epochs;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+
+    static std::string make_key(const std::string& coll, const nlohmann::json& filter);
+    void erase(std::list<Entry>::iterator it);
+};
+
+#endif
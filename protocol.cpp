@@ -1,9 +1,14 @@
 #include "protocol.hpp"
+#include "uring.hpp"
 
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
 #include <cstring>
 #include <iostream>
 
@@ -40,6 +45,20 @@ void TcpSocket::close() {
     }
 }
 
+void TcpSocket::shutdown() {
+    if (m_fd >= 0) ::shutdown(m_fd, SHUT_RDWR);
+}
+
+void TcpSocket::set_nodelay() {
+    int yes = 1;
+    ::setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+void TcpSocket::set_nonblocking() {
+    int flags = ::fcntl(m_fd, F_GETFL, 0);
+    if (flags >= 0) ::fcntl(m_fd, F_SETFL, flags | O_NONBLOCK);
+}
+
 void TcpSocket::connect_to(const std::string& host, uint16_t port) {
     if (m_fd >= 0) close();
 
@@ -135,11 +154,15 @@ void send_message(int fd, const std::string& body) {
     uint32_t len = (uint32_t)body.size();
     uint32_t net_len = htonl(len);
 
-    if (write_all(fd, &net_len, 4) != 4)
-        throw std::runtime_error("failed to send length");
+    // Header and body go out in one send() so a frame is never split into a
+    // tiny segment that Nagle would hold back.
+    std::string frame;
+    frame.reserve(4 + body.size());
+    frame.append((const char*)&net_len, 4);
+    frame.append(body);
 
-    if (write_all(fd, body.data(), body.size()) != (ssize_t)body.size())
-        throw std::runtime_error("failed to send body");
+    if (write_all(fd, frame.data(), frame.size()) != (ssize_t)frame.size())
+        throw std::runtime_error("failed to send message");
 }
 
 std::string recv_message(int fd) {
@@ -169,3 +192,705 @@ json recv_json(int fd) {
     std::string s = recv_message(fd);
     return json::parse(s);
 }
+
+
+// ---- Reactor ----
+
+// Replies a slow reader has not taken yet; past this its connection is
+// dropped instead of growing the buffer without bound.
+static constexpr size_t kMaxPendingOut = 16u << 20;
+// Frames read but not yet handled; past this the connection is not read
+// until the workers have worked it down to half.
+static constexpr size_t kMaxPendingIn = 4u << 20;
+static constexpr int kMaxEvents = 256;
+
+// io_uring: every connection receives into buffers from one shared group;
+// a buffer goes back to the kernel as soon as its bytes are copied out.
+static constexpr unsigned kRingEntries = 4096;
+static constexpr uint16_t kRecvGroup = 0;
+static constexpr unsigned kRecvBuffers = 256;
+static constexpr unsigned kRecvBufferSize = 32 * 1024;
+
+// user_data of a ring request: the operation in the top byte, then the
+// connection's serial (fds are reused, serials are not).
+enum : uint64_t { kOpAccept = 1, kOpRecv, kOpSend, kOpWake, kOpAcceptRetry };
+static constexpr uint64_t kSerialMask = (uint64_t(1) << 56) - 1;
+
+static uint64_t ring_tag(uint64_t op, uint64_t serial) {
+    return op << 56 | serial;
+}
+
+// Out of descriptors or memory, accept waits this long before trying again.
+static const __kernel_timespec kAcceptRetry{0, 100 * 1000 * 1000};
+
+struct Reactor::Conn {
+    TcpSocket sock;
+    std::string in;             // loop thread only: bytes not yet framed
+
+    // io_uring, loop thread only
+    uint64_t serial = 0;
+    int inFlight = 0;           // armed receive and pending send
+    bool receiving = false;     // a receive is armed
+    bool cancelling = false;    // ... and asked to stop
+    bool released = false;      // socket closed; waiting out those
+    std::string sending;        // the send in flight reads from here
+    size_t sendingOff = 0;
+
+    std::mutex mtx;             // guards everything below
+    std::string out;            // frames the socket has not taken yet
+    size_t outOff = 0;
+    bool sendBusy = false;      // io_uring: in toSend or a send in flight
+    std::deque<std::string> inbox;
+    size_t inboxBytes = 0;
+    bool paused = false;        // inbox full: the loop thread stopped reading
+    bool scheduled = false;     // queued for or held by a worker
+    bool ending = false;        // no more frames; close once inbox drains
+    bool closed = false;        // on_close started; send() refuses
+};
+
+Reactor::Reactor(size_t workers, Handlers h, Backend backend)
+    : handlers(std::move(h)), nworkers(std::max<size_t>(1, workers)), mode(backend) {}
+
+Reactor::~Reactor() {
+    if (epfd >= 0) ::close(epfd);
+    if (wakeFd >= 0) ::close(wakeFd);
+}
+
+Reactor::Stats Reactor::stats() const {
+    Stats s;
+    s.frames = nframes;
+    s.syscalls = nsyscalls;
+    return s;
+}
+
+Reactor::ConnPtr Reactor::find(int conn) {
+    std::lock_guard<std::mutex> lock(connsMtx);
+    auto it = conns.find(conn);
+    return it == conns.end() ? nullptr : it->second;
+}
+
+// Wakes the loop thread; one write covers every wake() until the loop has
+// seen it.
+void Reactor::wake() {
+    if (wakePending.exchange(true)) return;
+    uint64_t one = 1;
+    ssize_t n = ::write(wakeFd, &one, sizeof(one));
+    (void)n;
+    ++nsyscalls;
+}
+
+void Reactor::stop() {
+    stopping = true;
+    if (wakeFd >= 0) wake();
+}
+
+void Reactor::run(uint16_t port) {
+    listener.bind_and_listen(port, 512);
+    if (mode == Backend::IoUring && !setup_uring()) mode = Backend::Epoll;
+    // The ring waits on blocking descriptors itself; epoll needs them
+    // non-blocking.
+    bool uring = mode == Backend::IoUring;
+    wakeFd = ::eventfd(0, uring ? EFD_CLOEXEC : EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) throw std::runtime_error("eventfd failed");
+    if (!uring) {
+        listener.set_nonblocking();
+        epfd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) throw std::runtime_error("epoll setup failed");
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = listener.fd();
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, listener.fd(), &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeFd;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+    }
+
+    for (size_t i = 0; i < nworkers; ++i) workers.emplace_back(&Reactor::worker_loop, this);
+
+    if (uring) run_uring();
+    else run_epoll();
+
+    {
+        std::lock_guard<std::mutex> lock(readyMtx);
+        readyCv.notify_all();
+    }
+    for (auto& t : workers) t.join();
+    workers.clear();
+    ring.reset();       // cancels what is still armed before the buffers go
+    ringConns.clear();
+    std::lock_guard<std::mutex> lock(connsMtx);
+    conns.clear();
+    listener.close();
+}
+
+void Reactor::run_epoll() {
+    epoll_event events[kMaxEvents];
+    while (!stopping) {
+        int n = ::epoll_wait(epfd, events, kMaxEvents, -1);
+        ++nsyscalls;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("epoll_wait failed");
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listener.fd()) {
+                accept_all();
+            } else if (fd == wakeFd) {
+                wakePending = false;
+                uint64_t count;
+                while (::read(wakeFd, &count, sizeof(count)) > 0) ++nsyscalls;
+                ++nsyscalls;
+                resume_reading();
+                close_finished();
+            } else if (ConnPtr c = find(fd)) {
+                uint32_t e = events[i].events;
+                if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) on_readable(c);
+                if (e & EPOLLOUT) on_writable(c);
+            }
+        }
+    }
+}
+
+void Reactor::accept_all() {
+    while (true) {
+        int fd = ::accept4(listener.fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        ++nsyscalls;
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                std::cerr << "[Reactor] accept error: " << std::strerror(errno) << "\n";
+            return;
+        }
+        auto c = std::make_shared<Conn>();
+        c->sock = TcpSocket(fd);
+        c->sock.set_nodelay();
+        {
+            std::lock_guard<std::mutex> lock(connsMtx);
+            conns[fd] = c;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        nsyscalls += 2;
+    }
+}
+
+// Edge-triggered: read until the socket is empty, then cut frames. A
+// paused connection is left unread, edge or not; resume_reading() comes
+// back to it.
+void Reactor::on_readable(const ConnPtr& c) {
+    {
+        std::lock_guard<std::mutex> lock(c->mtx);
+        if (c->ending || c->paused) return;
+    }
+    bool eof = false;
+    char buf[64 * 1024];
+    while (true) {
+        ssize_t n = ::recv(c->sock.fd(), buf, sizeof(buf), 0);
+        ++nsyscalls;
+        if (n > 0) {
+            c->in.append(buf, n);
+            if (c->in.size() >= sizeof(buf) && !ingest(c, false)) return;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            eof = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+    }
+    ingest(c, eof);
+}
+
+// Cuts the complete frames out of c.in and hands them to a worker; eof
+// (or a malformed frame) ends the connection after them. Returns whether
+// to keep reading: false once the connection is ending or paused.
+bool Reactor::ingest(const ConnPtr& c, bool eof) {
+    std::vector<std::string> frames;
+    size_t pos = 0;
+    bool bad = false;
+    while (c->in.size() - pos >= 4) {
+        uint32_t net_len;
+        std::memcpy(&net_len, c->in.data() + pos, 4);
+        uint32_t len = ntohl(net_len);
+        if (len == 0 || len > MAX_MSG_SIZE) {
+            bad = true;
+            break;
+        }
+        if (c->in.size() - pos - 4 < len) break;
+        frames.emplace_back(c->in, pos + 4, len);
+        pos += 4 + len;
+    }
+    c->in.erase(0, pos);
+    nframes += frames.size();
+
+    std::lock_guard<std::mutex> lock(c->mtx);
+    if (c->ending) return false;
+    for (auto& f : frames) {
+        c->inboxBytes += f.size();
+        c->inbox.push_back(std::move(f));
+    }
+    if (eof || bad) c->ending = true;
+    if (c->inboxBytes > kMaxPendingIn) c->paused = true;
+    if ((!frames.empty() || c->ending) && !c->scheduled) {
+        c->scheduled = true;
+        std::lock_guard<std::mutex> rl(readyMtx);
+        ready.push_back(c);
+        readyCv.notify_one();
+    }
+    return !c->ending && !c->paused;
+}
+
+// Loop thread: reads again from the connections the workers have drained
+// enough since they were paused.
+void Reactor::resume_reading() {
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(connsMtx);
+        fds.swap(toResume);
+    }
+    for (int fd : fds) {
+        ConnPtr c = find(fd);
+        if (!c) continue;
+        if (!ring) on_readable(c);
+        else if (!c->released && !c->receiving) arm_recv(*c);
+        // else the cancelled receive re-arms itself as it completes
+    }
+}
+
+void Reactor::on_writable(const ConnPtr& c) {
+    std::lock_guard<std::mutex> lock(c->mtx);
+    if (c->closed) return;
+    if (!flush(*c)) end(*c, c);
+}
+
+// Writes buffered output until the socket is full. Caller holds c.mtx.
+bool Reactor::flush(Conn& c) {
+    while (c.outOff < c.out.size()) {
+        ssize_t n = ::send(c.sock.fd(), c.out.data() + c.outOff, c.out.size() - c.outOff, MSG_NOSIGNAL);
+        ++nsyscalls;
+        if (n > 0) {
+            c.outOff += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (c.outOff == c.out.size()) {
+        c.out.clear();
+        c.outOff = 0;
+    } else if (c.outOff > c.out.size() / 2) {
+        c.out.erase(0, c.outOff);
+        c.outOff = 0;
+    }
+    return true;
+}
+
+// Marks c as ending and makes sure a worker will finish it. Caller holds
+// c.mtx.
+void Reactor::end(Conn& c, const ConnPtr& self) {
+    c.ending = true;
+    if (c.scheduled) return;
+    c.scheduled = true;
+    std::lock_guard<std::mutex> rl(readyMtx);
+    ready.push_back(self);
+    readyCv.notify_one();
+}
+
+bool Reactor::send(int conn, const std::string& body) {
+    if (body.empty() || body.size() > MAX_MSG_SIZE) return false;
+    ConnPtr c = find(conn);
+    if (!c) return false;
+
+    uint32_t net_len = htonl((uint32_t)body.size());
+    std::unique_lock<std::mutex> lock(c->mtx);
+    if (c->closed) return false;
+    c->out.append((const char*)&net_len, 4);
+    c->out.append(body);
+    if (mode == Backend::IoUring) {
+        // The loop thread owns the ring: queue the connection for it,
+        // once per batch of replies.
+        if (c->out.size() > kMaxPendingOut) {
+            end(*c, c);
+            return false;
+        }
+        if (c->sendBusy) return true;
+        c->sendBusy = true;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> sl(sendMtx);
+            toSend.push_back(std::move(c));
+        }
+        wake();
+        return true;
+    }
+    if (!flush(*c) || c->out.size() - c->outOff > kMaxPendingOut) {
+        end(*c, c);
+        return false;
+    }
+    return true;
+}
+
+void Reactor::close(int conn) {
+    ConnPtr c = find(conn);
+    if (!c) return;
+    std::lock_guard<std::mutex> lock(c->mtx);
+    end(*c, c);
+}
+
+void Reactor::worker_loop() {
+    while (true) {
+        ConnPtr c;
+        {
+            std::unique_lock<std::mutex> lock(readyMtx);
+            readyCv.wait(lock, [&] { return stopping || !ready.empty(); });
+            if (stopping) return;
+            c = std::move(ready.front());
+            ready.pop_front();
+        }
+        drain(c);
+    }
+}
+
+// Handles c's frames in order while it has any; the worker that finds an
+// ending connection drained runs on_close and hands the socket back to
+// the loop thread to close.
+void Reactor::drain(const ConnPtr& c) {
+    int fd = c->sock.fd();
+    while (true) {
+        std::string body;
+        bool resume = false;
+        {
+            std::lock_guard<std::mutex> lock(c->mtx);
+            if (c->inbox.empty()) {
+                if (!c->ending) {
+                    c->scheduled = false;
+                    return;
+                }
+                c->closed = true;
+                break;
+            }
+            body = std::move(c->inbox.front());
+            c->inbox.pop_front();
+            c->inboxBytes -= body.size();
+            if (c->paused && c->inboxBytes <= kMaxPendingIn / 2 && !c->ending) {
+                c->paused = false;
+                resume = true;
+            }
+        }
+        if (resume) {
+            {
+                std::lock_guard<std::mutex> lock(connsMtx);
+                toResume.push_back(fd);
+            }
+            wake();
+        }
+        try {
+            if (handlers.on_frame) handlers.on_frame(fd, std::move(body));
+        } catch (const std::exception&) {
+            std::lock_guard<std::mutex> lock(c->mtx);
+            c->ending = true;
+            c->inbox.clear();
+            c->inboxBytes = 0;
+        }
+    }
+
+    if (handlers.on_close) {
+        try {
+            handlers.on_close(fd);
+        } catch (const std::exception& e) {
+            std::cerr << "[Reactor] on_close: " << e.what() << "\n";
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(connsMtx);
+        toClose.push_back(fd);
+    }
+    wake();
+}
+
+// Loop thread: only it closes sockets, so an fd is never reused while the
+// loop may still read from it.
+void Reactor::close_finished() {
+    std::vector<ConnPtr> done;
+    {
+        std::lock_guard<std::mutex> lock(connsMtx);
+        for (int fd : toClose) {
+            auto it = conns.find(fd);
+            if (it == conns.end()) continue;
+            done.push_back(std::move(it->second));
+            conns.erase(it);
+        }
+        toClose.clear();
+    }
+    if (ring) {
+        // Replies sent before on_close still go out as far as the socket
+        // has room, as they would have been written directly with epoll.
+        submit_sends();
+        bool flushing = false;
+        for (auto& c : done) {
+            std::lock_guard<std::mutex> lock(c->mtx);
+            flushing |= c->sendBusy;
+        }
+        if (flushing) nsyscalls += ring->submit();
+        for (auto& c : done) release(c);
+        return;
+    }
+    for (auto& c : done) {
+        ::epoll_ctl(epfd, EPOLL_CTL_DEL, c->sock.fd(), nullptr);
+        c->sock.close();
+        nsyscalls += 2;
+    }
+}
+
+// ---- Reactor: io_uring backend ----
+
+bool Reactor::setup_uring() {
+    try {
+        ring = std::make_unique<Uring>(kRingEntries);
+        for (uint8_t op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ,
+                           IORING_OP_PROVIDE_BUFFERS, IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL}) {
+            if (!ring->supports(op))
+                throw std::runtime_error("kernel lacks io_uring opcode " + std::to_string(op));
+        }
+        if (!(ring->features() & IORING_FEAT_CQE_SKIP))
+            throw std::runtime_error("kernel lacks IOSQE_CQE_SKIP_SUCCESS");
+        ring->provide_buffers(kRecvGroup, kRecvBuffers, kRecvBufferSize);
+        probe_multishot();
+        return true;
+    } catch (const std::exception& e) {
+        ring.reset();
+        std::cerr << "[Reactor] io_uring unavailable (" << e.what() << "), using epoll\n";
+        return false;
+    }
+}
+
+// Opcodes can be probed but their flags cannot: arm a multishot receive
+// on a socket pair and check that it delivers and stays armed. Multishot
+// accept is older than multishot receive, so this covers it as well.
+void Reactor::probe_multishot() {
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        throw std::runtime_error("socketpair failed");
+    TcpSocket a(sv[0]), b(sv[1]);
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_RECV, a.fd(), ring_tag(kOpRecv, 0));
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = kRecvGroup;
+    char byte = 0;
+    if (::write(b.fd(), &byte, 1) != 1) throw std::runtime_error("socketpair write failed");
+
+    bool delivered = false, armed = true;
+    while (armed) {
+        ring->submit_and_wait();
+        ring->reap([&](const io_uring_cqe& cqe) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) ring->recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (!(cqe.flags & IORING_CQE_F_MORE)) armed = false;
+            else if (cqe.res > 0) delivered = true;
+        });
+        if (armed && delivered) a.shutdown();   // ends the receive with a final completion
+    }
+    if (!delivered) throw std::runtime_error("kernel lacks multishot receive");
+}
+
+void Reactor::run_uring() {
+    arm_accept();
+    arm_wake();
+    while (!stopping) {
+        nsyscalls += ring->submit_and_wait();
+        bool woken = false;
+        ring->reap([&](const io_uring_cqe& cqe) {
+            if (cqe.user_data >> 56 == kOpWake) woken = true;
+            else on_completion(cqe);
+        });
+        if (woken) {
+            wakePending = false;
+            arm_wake();
+            submit_sends();
+            resume_reading();
+            close_finished();
+        }
+    }
+}
+
+void Reactor::on_completion(const io_uring_cqe& cqe) {
+    uint64_t op = cqe.user_data >> 56;
+    if (op == kOpAcceptRetry) {
+        if (!stopping) arm_accept();
+        return;
+    }
+    if (op == kOpAccept) {
+        int err = cqe.res < 0 ? -cqe.res : 0;
+        if (cqe.res >= 0) on_accepted(cqe.res);
+        bool transient = err == 0 || err == ECONNABORTED || err == EINTR || err == EAGAIN
+                         || err == EPROTO || err == EPERM;
+        bool exhausted = err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+        if (!transient && !stopping)
+            std::cerr << "[Reactor] accept error: " << std::strerror(err) << "\n";
+        if ((cqe.flags & IORING_CQE_F_MORE) || stopping) return;
+        if (transient) {
+            arm_accept();
+        } else if (exhausted) {
+            io_uring_sqe& sqe = ring->prepare(IORING_OP_TIMEOUT, -1, ring_tag(kOpAcceptRetry, 0));
+            sqe.addr = reinterpret_cast<uint64_t>(&kAcceptRetry);
+            sqe.len = 1;
+        } else {
+            // Re-arming would fail the same way at once, in a busy loop.
+            std::cerr << "[Reactor] no longer accepting connections\n";
+        }
+        return;
+    }
+
+    // Misses also take in a failed buffer recycle (user_data 0).
+    auto it = ringConns.find(cqe.user_data & kSerialMask);
+    if (it == ringConns.end()) {
+        if (cqe.flags & IORING_CQE_F_BUFFER) ring->recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        return;
+    }
+    ConnPtr c = it->second;
+    if (op == kOpRecv) on_received(c, cqe);
+    else if (op == kOpSend) on_sent(c, cqe.res);
+    if (c->released && c->inFlight == 0) ringConns.erase(c->serial);
+}
+
+void Reactor::on_accepted(int fd) {
+    auto c = std::make_shared<Conn>();
+    c->sock = TcpSocket(fd);
+    c->sock.set_nodelay();
+    ++nsyscalls;
+    c->serial = ++nextSerial;
+    {
+        std::lock_guard<std::mutex> lock(connsMtx);
+        conns[fd] = c;
+    }
+    ringConns[c->serial] = c;
+    arm_recv(*c);
+}
+
+// One completion per chunk received; the receive stays armed while the
+// kernel sets IORING_CQE_F_MORE. A paused connection has its receive
+// cancelled, and it is armed again only once the workers catch up.
+void Reactor::on_received(const ConnPtr& c, const io_uring_cqe& cqe) {
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more) {
+        --c->inFlight;
+        c->receiving = false;
+    }
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe.res > 0 && !c->released) c->in.append(ring->buffer(id), cqe.res);
+        ring->recycle(id);
+    }
+    if (c->released) return;
+    // ENOBUFS: every buffer was in use; some are back by now.
+    if (cqe.res > 0 || cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+        bool reading = ingest(c, false);
+        if (!more && reading) arm_recv(*c);
+        else if (more && !reading && !c->cancelling) cancel_recv(*c);
+    } else {
+        ingest(c, true);
+    }
+}
+
+void Reactor::on_sent(const ConnPtr& c, int res) {
+    --c->inFlight;
+    if (c->released) return;
+    std::lock_guard<std::mutex> lock(c->mtx);
+    if (res < 0) {
+        // sendBusy stays set, so nothing more is queued for the ring.
+        c->sending.clear();
+        if (!c->closed) end(*c, c);
+        return;
+    }
+    c->sendingOff += (size_t)res;
+    if (c->sendingOff == c->sending.size()) {
+        c->sending.clear();
+        c->sendingOff = 0;
+        if (c->out.empty()) {
+            c->sendBusy = false;
+            return;
+        }
+        c->sending.swap(c->out);
+    }
+    issue_send(*c);
+}
+
+void Reactor::submit_sends() {
+    std::vector<ConnPtr> batch;
+    {
+        std::lock_guard<std::mutex> lock(sendMtx);
+        batch.swap(toSend);
+    }
+    for (auto& c : batch) start_send(c);
+}
+
+// The output queued since the last send becomes the next one, unless a
+// send is still in flight; on_sent picks it up then.
+void Reactor::start_send(const ConnPtr& c) {
+    if (c->released) return;
+    std::lock_guard<std::mutex> lock(c->mtx);
+    if (!c->sending.empty()) return;
+    if (c->out.empty()) {
+        c->sendBusy = false;
+        return;
+    }
+    c->sending.swap(c->out);
+    c->sendingOff = 0;
+    issue_send(*c);
+}
+
+// Caller holds c.mtx; c.sending must stay untouched until the completion.
+void Reactor::issue_send(Conn& c) {
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_SEND, c.sock.fd(), ring_tag(kOpSend, c.serial));
+    sqe.addr = reinterpret_cast<uint64_t>(c.sending.data() + c.sendingOff);
+    sqe.len = (uint32_t)(c.sending.size() - c.sendingOff);
+    sqe.msg_flags = MSG_NOSIGNAL;
+    ++c.inFlight;
+}
+
+void Reactor::arm_accept() {
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_ACCEPT, listener.fd(), ring_tag(kOpAccept, 0));
+    sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe.accept_flags = SOCK_CLOEXEC;
+}
+
+void Reactor::arm_recv(Conn& c) {
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_RECV, c.sock.fd(), ring_tag(kOpRecv, c.serial));
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = kRecvGroup;
+    ++c.inFlight;
+    c.receiving = true;
+    c.cancelling = false;
+}
+
+// Ends c's armed receive with a final -ECANCELED completion. Chunks it
+// already took still arrive first. A failed cancel (the receive had just
+// ended) completes as a miss, user_data 0.
+void Reactor::cancel_recv(Conn& c) {
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_ASYNC_CANCEL, -1, 0);
+    sqe.addr = ring_tag(kOpRecv, c.serial);
+    sqe.flags = IOSQE_CQE_SKIP_SUCCESS;
+    c.cancelling = true;
+}
+
+void Reactor::arm_wake() {
+    io_uring_sqe& sqe = ring->prepare(IORING_OP_READ, wakeFd, ring_tag(kOpWake, 0));
+    sqe.addr = reinterpret_cast<uint64_t>(&wakeCount);
+    sqe.len = sizeof(wakeCount);
+    sqe.off = (uint64_t)-1;
+}
+
+// Shuts the socket down so its armed receive completes, and closes it;
+// the Conn lives on in ringConns until its last completion.
+void Reactor::release(const ConnPtr& c) {
+    c->released = true;
+    ::shutdown(c->sock.fd(), SHUT_RDWR);
+    c->sock.close();
+    nsyscalls += 2;
+    if (c->inFlight == 0) ringConns.erase(c->serial);
+}
@@ -5,9 +5,20 @@
 #include <cstdint>
 #include <stdexcept>
 #include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <netinet/in.h>
 #include "json.hpp"
 
+class Uring;
+struct io_uring_cqe;
+
 // Max body size: 64 KiB per spec
 constexpr uint32_t MAX_MSG_SIZE = 65536;
 
@@ -27,6 +38,9 @@ public:
     int  fd() const;
 
     void close();
+    void shutdown();        // wakes up threads blocked in recv on this socket
+    void set_nodelay();
+    void set_nonblocking();
 
     void connect_to(const std::string& host, uint16_t port);
 
@@ -47,4 +61,124 @@ std::string recv_message(int fd);
 void send_json(int fd, const nlohmann::json& j);
 nlohmann::json recv_json(int fd);
 
+// Event loop for servers speaking the framed protocol above, in place of
+// a thread per connection. One thread waits in edge-triggered epoll on the
+// listening socket and every connection, reads whatever has arrived into
+// the connection's buffer and cuts complete frames out of it. Frames are
+// handled on a small worker pool: those of one connection one at a time
+// and in arrival order, so a client may pipeline requests and still get
+// replies in order. Replies are written straight away when the socket has
+// room and otherwise buffered until epoll reports it writable.
+//
+// With the io_uring backend the loop thread instead keeps a multishot
+// accept and, per connection, a multishot receive armed in the kernel;
+// received bytes land in buffers handed to the kernel up front and
+// replies go out as ring sends, so a busy loop makes one system call per batch of
+// completions rather than several per frame.
+class Reactor {
+public:
+    // Chosen at construction. run() falls back to Epoll, with a note on
+    // stderr, if the kernel cannot set up io_uring.
+    enum class Backend { Epoll, IoUring };
+
+    // Counters for comparing backends. Syscalls are those made on the I/O
+    // path: by the loop thread and by send(); not the workers' futexes.
+    struct Stats {
+        uint64_t frames = 0;
+        uint64_t syscalls = 0;
+    };
+
+    // Handlers name a connection by its socket fd, which stays its own
+    // until on_close has returned. A handler that throws closes the
+    // connection.
+    struct Handlers {
+        std::function<void(int conn, std::string body)> on_frame;
+        std::function<void(int conn)> on_close;     // after its last on_frame
+    };
+
+    Reactor(size_t workers, Handlers handlers, Backend backend = Backend::Epoll);
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Accepts and serves connections until stop(); throws if the port
+    // cannot be bound.
+    void run(uint16_t port);
+    void stop();
+
+    // Queues one frame to conn; callable from any thread. Returns false if
+    // the connection is gone or failing, or body is not a valid frame.
+    bool send(int conn, const std::string& body);
+    // Closes conn once the frames already read from it are handled.
+    void close(int conn);
+
+    // The backend in use; final once run() has started serving.
+    Backend backend() const { return mode; }
+    Stats stats() const;
+
+private:
+    struct Conn;
+    using ConnPtr = std::shared_ptr<Conn>;
+
+    Handlers handlers;
+    size_t nworkers;
+    std::atomic<Backend> mode;
+    int epfd = -1;
+    int wakeFd = -1;        // eventfd: stop(), closes and ring sends for the loop
+    std::atomic<bool> wakePending{false};
+    TcpSocket listener;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> nframes{0};
+    std::atomic<uint64_t> nsyscalls{0};
+
+    std::mutex connsMtx;
+    std::unordered_map<int, ConnPtr> conns;
+    std::vector<int> toClose;   // under connsMtx; closed by the loop thread
+    std::vector<int> toResume;  // under connsMtx; paused, now drained
+
+    // io_uring backend; all but toSend belong to the loop thread.
+    std::unique_ptr<Uring> ring;
+    std::unordered_map<uint64_t, ConnPtr> ringConns;   // by serial, until the last completion
+    uint64_t nextSerial = 0;
+    uint64_t wakeCount = 0;     // the eventfd read lands here
+    std::mutex sendMtx;
+    std::vector<ConnPtr> toSend;    // connections with output for the ring
+
+    std::mutex readyMtx;
+    std::condition_variable readyCv;
+    std::deque<ConnPtr> ready;  // connections with frames for a worker
+    std::vector<std::thread> workers;
+
+    ConnPtr find(int conn);
+    void wake();
+    void run_epoll();
+    void accept_all();
+    void on_readable(const ConnPtr& c);
+    bool ingest(const ConnPtr& c, bool eof);
+    void resume_reading();
+    void on_writable(const ConnPtr& c);
+    bool flush(Conn& c);
+    void end(Conn& c, const ConnPtr& self);
+    void worker_loop();
+    void drain(const ConnPtr& c);
+    void close_finished();
+
+    bool setup_uring();
+    void probe_multishot();
+    void run_uring();
+    void on_completion(const io_uring_cqe& cqe);
+    void on_accepted(int fd);
+    void on_received(const ConnPtr& c, const io_uring_cqe& cqe);
+    void on_sent(const ConnPtr& c, int res);
+    void arm_accept();
+    void arm_recv(Conn& c);
+    void cancel_recv(Conn& c);
+    void arm_wake();
+    void start_send(const ConnPtr& c);
+    void issue_send(Conn& c);
+    void submit_sends();
+    void release(const ConnPtr& c);
+};
+
 #endif 
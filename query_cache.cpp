@@ -0,0 +1,62 @@
+#include "query_cache.hpp"
+
+using nlohmann::json;
+
+QueryCache::QueryCache(size_t cap) : capacity(cap ? cap : 1) {}
+
+bool QueryCache::lookup(const std::string& key, uint64_t generation, std::string& out) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return false;
+    }
+    if (it->second->generation != generation) {
+        lru.erase(it->second);
+        index.erase(it);
+        ++invalidations;
+        ++misses;
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    out = it->second->value;
+    ++hits;
+    return true;
+}
+
+void QueryCache::store(const std::string& key, uint64_t generation, std::string value) {
+    auto it = index.find(key);
+    if (it != index.end()) {
+        it->second->generation = generation;
+        it->second->value = std::move(value);
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    lru.push_front({key, generation, std::move(value)});
+    index[key] = lru.begin();
+
+    while (lru.size() > capacity) {
+        index.erase(lru.back().key);
+        lru.pop_back();
+        ++evictions;
+    }
+}
+
+void QueryCache::clear() {
+    invalidations += lru.size();
+    lru.clear();
+    index.clear();
+}
+
+json QueryCache::stats() const {
+    uint64_t lookups = hits + misses;
+    return {
+        {"capacity", capacity},
+        {"entries", lru.size()},
+        {"hits", hits},
+        {"misses", misses},
+        {"evictions", evictions},
+        {"invalidations", invalidations},
+        {"hitRate", lookups ? (double)hits / (double)lookups : 0.0}
+    };
+}
@@ -0,0 +1,40 @@
+#ifndef QUERY_CACHE_HPP
+#define QUERY_CACHE_HPP
+
+#include "json.hpp"
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// LRU cache of serialized read/query responses.
+// Every entry remembers the generation of its collection at the time it was
+// filled; a lookup against a newer generation is a miss and drops the entry.
+class QueryCache {
+public:
+    explicit QueryCache(size_t capacity);
+
+    bool lookup(const std::string& key, uint64_t generation, std::string& out);
+    void store(const std::string& key, uint64_t generation, std::string value);
+    void clear();
+
+    nlohmann::json stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::string value;
+    };
+
+    size_t capacity;
+    std::list<Entry> lru;   // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+};
+
+#endif
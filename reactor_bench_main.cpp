@@ -0,0 +1,145 @@
+#include "protocol.hpp"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+// Echo benchmark for the Reactor's I/O backends:
+//   reactor_bench [--io epoll|uring|both] [--conns N] [--depth D]
+//                 [--size BYTES] [--seconds S] [--workers W] [--port P]
+// Starts an in-process echo server per backend; each client connection
+// keeps D frames of BYTES in flight and tops them up as replies arrive.
+// Reports round trips per second and the server's I/O system calls per
+// frame (Reactor::Stats; the clients' own calls are not counted).
+
+struct Options {
+    size_t conns = 8;
+    size_t depth = 16;
+    size_t size = 64;
+    int seconds = 5;
+    size_t workers = 4;
+    uint16_t port = 12990;
+};
+
+static void append_frame(string& out, const string& body) {
+    uint32_t net_len = htonl((uint32_t)body.size());
+    out.append((const char*)&net_len, 4);
+    out.append(body);
+}
+
+// One connection's load: refill the window with as many frames as
+// replies came back, one write per batch.
+static void client_loop(uint16_t port, const Options& opt, const atomic<bool>& start,
+                        const atomic<bool>& stop, uint64_t& replies) {
+    TcpSocket sock;
+    sock.connect_to("127.0.0.1", port);
+    sock.set_nodelay();
+    string body(opt.size, 'x');
+    string out;
+    while (!start) this_thread::yield();
+
+    for (size_t i = 0; i < opt.depth; ++i) append_frame(out, body);
+    if (write_all(sock.fd(), out.data(), out.size()) < 0) return;
+
+    string in;
+    char buf[64 * 1024];
+    while (!stop) {
+        ssize_t n = ::recv(sock.fd(), buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        in.append(buf, n);
+        size_t pos = 0, done = 0;
+        while (in.size() - pos >= 4) {
+            uint32_t net_len;
+            memcpy(&net_len, in.data() + pos, 4);
+            uint32_t len = ntohl(net_len);
+            if (in.size() - pos - 4 < len) break;
+            pos += 4 + len;
+            ++done;
+        }
+        in.erase(0, pos);
+        replies += done;
+        out.clear();
+        for (size_t i = 0; i < done; ++i) append_frame(out, body);
+        if (!out.empty() && write_all(sock.fd(), out.data(), out.size()) < 0) return;
+    }
+}
+
+static void bench(Reactor::Backend backend, uint16_t port, const Options& opt) {
+    Reactor* server = nullptr;
+    Reactor::Handlers handlers;
+    handlers.on_frame = [&server](int conn, string body) { server->send(conn, body); };
+    Reactor reactor(opt.workers, move(handlers), backend);
+    server = &reactor;
+    thread loop([&] { reactor.run(port); });
+
+    // Wait for the listener.
+    for (int i = 0; i < 200; ++i) {
+        try {
+            TcpSocket probe;
+            probe.connect_to("127.0.0.1", port);
+            break;
+        } catch (const exception&) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+
+    atomic<bool> start{false}, stop{false};
+    vector<uint64_t> replies(opt.conns, 0);
+    vector<thread> clients;
+    for (size_t i = 0; i < opt.conns; ++i)
+        clients.emplace_back(client_loop, port, cref(opt), cref(start), cref(stop), ref(replies[i]));
+    this_thread::sleep_for(chrono::milliseconds(200));     // connected and waiting
+
+    Reactor::Stats s0 = reactor.stats();
+    auto t0 = chrono::steady_clock::now();
+    start = true;
+    this_thread::sleep_for(chrono::seconds(opt.seconds));
+    Reactor::Stats s1 = reactor.stats();
+    auto t1 = chrono::steady_clock::now();
+    stop = true;
+    for (auto& t : clients) t.join();
+    reactor.stop();
+    loop.join();
+
+    double secs = chrono::duration<double>(t1 - t0).count();
+    uint64_t frames = s1.frames - s0.frames;
+    uint64_t total = 0;
+    for (uint64_t r : replies) total += r;
+    const char* name = reactor.backend() == Reactor::Backend::IoUring ? "uring" : "epoll";
+    cout << name << ": " << (uint64_t)(total / secs) << " round trips/s, "
+         << (frames ? (double)(s1.syscalls - s0.syscalls) / frames : 0.0) << " syscalls/frame"
+         << " (" << opt.conns << " conns, depth " << opt.depth << ", " << opt.size << " B)\n";
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    string io = "both";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string k = argv[i];
+        string v = argv[i+1];
+        if (k == "--io") io = v;
+        else if (k == "--conns") opt.conns = stoul(v);
+        else if (k == "--depth") opt.depth = stoul(v);
+        else if (k == "--size") opt.size = stoul(v);
+        else if (k == "--seconds") opt.seconds = stoi(v);
+        else if (k == "--workers") opt.workers = stoul(v);
+        else if (k == "--port") opt.port = static_cast<uint16_t>(stoi(v));
+    }
+    if ((io != "epoll" && io != "uring" && io != "both") || opt.depth == 0
+        || opt.size == 0 || opt.size > MAX_MSG_SIZE) {
+        cerr << "usage: reactor_bench [--io epoll|uring|both] [--conns N] [--depth D] "
+                "[--size BYTES] [--seconds S] [--workers W] [--port P]\n";
+        return 2;
+    }
+
+    try {
+        if (io != "uring") bench(Reactor::Backend::Epoll, opt.port, opt);
+        if (io != "epoll") bench(Reactor::Backend::IoUring, opt.port + 1, opt);
+    } catch (const exception& e) {
+        cerr << "reactor_bench: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
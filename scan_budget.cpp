@@ -0,0 +1,45 @@
+#include "scan_budget.hpp"
+
+// The clock and the kill flag are polled every this many documents.
+static constexpr size_t kPollEvery = 256;
+
+ScanBudget::ScanBudget(size_t maxScan, int maxTimeMs, const std::atomic<bool>* killed,
+                       bool allowPartial)
+    : allowPartial(allowPartial), maxScan(maxScan), hasDeadline(maxTimeMs > 0),
+      deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(maxTimeMs)),
+      killed(killed) {}
+
+void ScanBudget::stop(Reason r) {
+    Reason none = Reason::None;
+    stopReason.compare_exchange_strong(none, r, std::memory_order_relaxed);
+}
+
+bool ScanBudget::step() {
+    if (exhausted()) return false;
+    size_t n = count.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (maxScan && n > maxScan) {
+        stop(Reason::MaxScan);
+        return false;
+    }
+    if (n % kPollEvery == 1) {
+        if (killed && killed->load(std::memory_order_relaxed)) stop(Reason::Killed);
+        else if (hasDeadline && std::chrono::steady_clock::now() > deadline) stop(Reason::MaxTime);
+    }
+    return !exhausted();
+}
+
+// The step that tripped maxScan did not examine a document.
+size_t ScanBudget::scanned() const {
+    size_t n = count.load(std::memory_order_relaxed);
+    return maxScan && n > maxScan ? maxScan : n;
+}
+
+const char* ScanBudget::describe(Reason r) {
+    switch (r) {
+    case Reason::MaxScan: return "maxScan exceeded";
+    case Reason::MaxTime: return "operation exceeded maxTimeMs";
+    case Reason::Killed:  return "operation was killed";
+    case Reason::None:    break;
+    }
+    return "";
+}
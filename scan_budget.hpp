@@ -0,0 +1,44 @@
+#ifndef SCAN_BUDGET_HPP
+#define SCAN_BUDGET_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+// Limits on the scan work of one request: documents examined, wall time,
+// and an external kill flag (killOp). Scan loops call step() once per
+// document they examine and stop as soon as it returns false; workers of
+// a parallel scan may share one budget.
+class ScanBudget {
+public:
+    enum class Reason { None, MaxScan, MaxTime, Killed };
+
+    // maxScan 0 and maxTimeMs 0 mean unlimited; killed may be null. With
+    // allowPartial a read over budget returns what it found so far instead
+    // of failing; writes never apply partially.
+    ScanBudget(size_t maxScan, int maxTimeMs, const std::atomic<bool>* killed,
+               bool allowPartial = false);
+
+    const bool allowPartial;
+
+    bool step();
+    bool exhausted() const { return reason() != Reason::None; }
+    Reason reason() const { return stopReason.load(std::memory_order_relaxed); }
+    size_t scanned() const;
+
+    // "maxScan exceeded", "operation exceeded maxTimeMs", ...
+    static const char* describe(Reason r);
+
+private:
+    size_t maxScan;
+    bool hasDeadline;
+    std::chrono::steady_clock::time_point deadline;
+    const std::atomic<bool>* killed;
+
+    std::atomic<size_t> count{0};
+    std::atomic<Reason> stopReason{Reason::None};
+
+    void stop(Reason r);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "scan_pool.hpp"
+
+ScanPool::ScanPool(size_t threads) {
+    // The caller of run() works too, so it counts as one of the threads.
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(&ScanPool::worker_loop, this);
+    }
+}
+
+ScanPool::~ScanPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    wakeCv.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+// Called with mtx held; releases it while a task runs.
+void ScanPool::drain(std::unique_lock<std::mutex>& lock) {
+    while (nextTask < taskCount) {
+        size_t i = nextTask++;
+        lock.unlock();
+        (*job)(i);
+        lock.lock();
+    }
+}
+
+void ScanPool::run(size_t tasks, const std::function<void(size_t)>& fn) {
+    if (tasks == 0) return;
+    std::lock_guard<std::mutex> jobLock(jobMtx);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    job = &fn;
+    taskCount = tasks;
+    nextTask = 0;
+    ++jobSeq;
+    wakeCv.notify_all();
+
+    drain(lock);
+    doneCv.wait(lock, [&] { return running == 0; });
+    job = nullptr;
+    taskCount = 0;
+}
+
+void ScanPool::worker_loop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+        wakeCv.wait(lock, [&] { return stopping || jobSeq != seen; });
+        if (stopping) return;
+        seen = jobSeq;
+
+        ++running;
+        drain(lock);
+        if (--running == 0) doneCv.notify_all();
+    }
+}
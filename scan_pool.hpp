@@ -0,0 +1,48 @@
+#ifndef SCAN_POOL_HPP
+#define SCAN_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for data-parallel work such as full collection
+// scans. run() hands out task indices to the workers and the calling
+// thread alike and returns once every task has finished; one job runs at
+// a time.
+class ScanPool {
+public:
+    explicit ScanPool(size_t threads);
+    ~ScanPool();
+
+    ScanPool(const ScanPool&) = delete;
+    ScanPool& operator=(const ScanPool&) = delete;
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Calls fn(i) for every i in [0, tasks); fn must not throw.
+    void run(size_t tasks, const std::function<void(size_t)>& fn);
+
+private:
+    std::mutex jobMtx;      // serializes run() callers
+
+    std::mutex mtx;
+    std::condition_variable wakeCv;
+    std::condition_variable doneCv;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t taskCount = 0;
+    size_t nextTask = 0;
+    size_t running = 0;     // workers inside the current job
+    uint64_t jobSeq = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+
+    void worker_loop();
+    void drain(std::unique_lock<std::mutex>& lock);
+};
+
+#endif
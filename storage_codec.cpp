@@ -0,0 +1,145 @@
+#include "storage_codec.hpp"
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace {
+
+constexpr size_t kChunk = 64 * 1024;
+
+// Hands src through unchanged, a chunk at a time.
+class PassThroughBuf : public std::streambuf {
+public:
+    explicit PassThroughBuf(std::streambuf& src) : src(src) {}
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        std::streamsize n = src.sgetn(buf, sizeof(buf));
+        if (n <= 0) return traits_type::eof();
+        setg(buf, buf, buf + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::streambuf& src;
+    char buf[kChunk];
+};
+
+class NoneCodec : public StorageCodec {
+public:
+    uint8_t id() const override { return 0; }
+    const char* name() const override { return "none"; }
+    void compress(const std::string& raw, std::string& out) const override { out += raw; }
+    std::unique_ptr<std::streambuf> decompressor(std::streambuf& src) const override {
+        return std::make_unique<PassThroughBuf>(src);
+    }
+};
+
+// Inflates one zlib stream from src chunk by chunk, so a large file is
+// never held compressed and decompressed in memory at once.
+class InflateBuf : public std::streambuf {
+public:
+    explicit InflateBuf(std::streambuf& src) : src(src) {
+        if (inflateInit(&zs) != Z_OK) throw std::runtime_error("inflateInit failed");
+    }
+    ~InflateBuf() override { inflateEnd(&zs); }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        while (!done) {
+            if (zs.avail_in == 0) {
+                std::streamsize n = src.sgetn(in, sizeof(in));
+                if (n <= 0) throw std::runtime_error("truncated zlib stream");
+                zs.next_in = reinterpret_cast<Bytef*>(in);
+                zs.avail_in = static_cast<uInt>(n);
+            }
+            zs.next_out = reinterpret_cast<Bytef*>(out);
+            zs.avail_out = sizeof(out);
+            int rc = inflate(&zs, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) done = true;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR) throw std::runtime_error("corrupt zlib stream");
+            size_t produced = sizeof(out) - zs.avail_out;
+            if (produced) {
+                setg(out, out, out + produced);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    std::streambuf& src;
+    z_stream zs{};
+    bool done = false;
+    char in[kChunk];
+    char out[kChunk];
+};
+
+class ZlibCodec : public StorageCodec {
+public:
+    uint8_t id() const override { return 1; }
+    const char* name() const override { return "zlib"; }
+
+    void compress(const std::string& raw, std::string& out) const override {
+        z_stream zs{};
+        if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) throw std::runtime_error("deflateInit failed");
+        size_t start = out.size();
+        out.resize(start + deflateBound(&zs, raw.size()));
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw.data()));
+        zs.avail_in = static_cast<uInt>(raw.size());
+        zs.next_out = reinterpret_cast<Bytef*>(&out[start]);
+        zs.avail_out = static_cast<uInt>(out.size() - start);
+        int rc = deflate(&zs, Z_FINISH);
+        size_t written = zs.total_out;
+        deflateEnd(&zs);
+        if (rc != Z_STREAM_END) throw std::runtime_error("deflate failed");
+        out.resize(start + written);
+    }
+
+    std::unique_ptr<std::streambuf> decompressor(std::streambuf& src) const override {
+        return std::make_unique<InflateBuf>(src);
+    }
+};
+
+struct Registry {
+    std::mutex mtx;
+    std::map<uint8_t, std::unique_ptr<StorageCodec>> byId;
+
+    Registry() {
+        byId[0] = std::make_unique<NoneCodec>();
+        byId[1] = std::make_unique<ZlibCodec>();
+    }
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+} // namespace
+
+void register_codec(std::unique_ptr<StorageCodec> codec) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    uint8_t id = codec->id();
+    r.byId[id] = std::move(codec);
+}
+
+const StorageCodec* find_codec(const std::string& name) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    for (auto& [id, codec] : r.byId) {
+        if (name == codec->name()) return codec.get();
+    }
+    return nullptr;
+}
+
+const StorageCodec* find_codec(uint8_t id) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    auto it = r.byId.find(id);
+    return it == r.byId.end() ? nullptr : it->second.get();
+}
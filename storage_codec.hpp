@@ -0,0 +1,36 @@
+#ifndef STORAGE_CODEC_HPP
+#define STORAGE_CODEC_HPP
+
+#include <cstdint>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+// Compression for the database's data files. Every compressed block on
+// disk records the id of the codec that wrote it, so files stay readable
+// whichever codec is configured for new writes. Built in: "none" (id 0)
+// and "zlib" (id 1, fastest level).
+class StorageCodec {
+public:
+    virtual ~StorageCodec() = default;
+
+    // Stored on disk; an id must never be given to another codec.
+    virtual uint8_t id() const = 0;
+    virtual const char* name() const = 0;
+
+    // Appends the compressed form of raw to out as one self-contained block.
+    virtual void compress(const std::string& raw, std::string& out) const = 0;
+    // Reads one block from src; the returned buffer yields the raw bytes,
+    // decompressed as they are read. It may read src past the end of the
+    // block, so src should hold nothing else after it. src must outlive it.
+    virtual std::unique_ptr<std::streambuf> decompressor(std::streambuf& src) const = 0;
+};
+
+// Makes a codec available by name and id; replaces one with the same id.
+// Register codecs at startup, before any database uses them.
+void register_codec(std::unique_ptr<StorageCodec> codec);
+// nullptr if no such codec is registered.
+const StorageCodec* find_codec(const std::string& name);
+const StorageCodec* find_codec(uint8_t id);
+
+#endif
@@ -0,0 +1,127 @@
+#include "time_series.hpp"
+#include "db_filter.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using nlohmann::json;
+
+TimeSeries::TimeSeries(std::string field, size_t segSize)
+    : timeField(std::move(field)), segmentSize(segSize ? segSize : kDefaultSegmentSize) {}
+
+TimeSeries TimeSeries::from_spec(const json& spec) {
+    if (!spec.is_object() || !spec.contains("timeField") || !spec["timeField"].is_string()
+        || spec["timeField"].get<std::string>().empty())
+        throw std::invalid_argument("time series spec needs a timeField");
+    size_t segSize = kDefaultSegmentSize;
+    if (spec.contains("segmentSize")) {
+        if (!spec["segmentSize"].is_number_integer() || spec["segmentSize"].get<int64_t>() <= 0)
+            throw std::invalid_argument("segmentSize must be a positive integer");
+        segSize = spec["segmentSize"].get<size_t>();
+    }
+    return TimeSeries(spec["timeField"].get<std::string>(), segSize);
+}
+
+json TimeSeries::spec() const {
+    return {{"timeField", timeField}, {"segmentSize", segmentSize}};
+}
+
+double TimeSeries::time_of(const json& record) const {
+    return record.find(timeField)->get<double>();
+}
+
+bool TimeSeries::valid_record(const json& record) const {
+    if (!record.is_object()) return false;
+    auto it = record.find(timeField);
+    return it != record.end() && it->is_number();
+}
+
+void TimeSeries::append(json record) {
+    double t = time_of(record);
+    if (segments.empty() || segments.back().records.size() >= segmentSize) {
+        segments.push_back({t, t, {}});
+        segments.back().records.reserve(segmentSize);
+    }
+    Segment& seg = segments.back();
+    seg.minTime = std::min(seg.minTime, t);
+    seg.maxTime = std::max(seg.maxTime, t);
+    seg.records.push_back(std::move(record));
+
+    if (count > 0 && t < lastTime) ordered = false;
+    lastTime = count == 0 ? t : std::max(lastTime, t);
+    ++count;
+}
+
+std::vector<const json*> TimeSeries::scan(const json& filter, size_t limit, bool desc) const {
+    // Bounds on the time field used for pruning only; the predicate still
+    // decides strict vs. inclusive comparisons per record.
+    double lo = -std::numeric_limits<double>::infinity();
+    double hi = std::numeric_limits<double>::infinity();
+    if (filter.is_object()) {
+        auto it = filter.find(timeField);
+        if (it != filter.end() && it->is_number()) {
+            lo = hi = it->get<double>();
+        } else if (it != filter.end() && it->is_object()) {
+            for (auto op = it->begin(); op != it->end(); ++op) {
+                if (!op->is_number()) continue;
+                double v = op->get<double>();
+                if (op.key() == "$gt" || op.key() == "$gte") lo = std::max(lo, v);
+                else if (op.key() == "$lt" || op.key() == "$lte") hi = std::min(hi, v);
+            }
+        }
+    }
+
+    Predicate pred(filter);
+    std::vector<const json*> out;
+
+    // An in-order series yields records already sorted by time, so the
+    // scan can stop as soon as it has enough.
+    auto visit = [&](const Segment& seg) {
+        if (seg.maxTime < lo || seg.minTime > hi) {
+            ++segmentsPruned;
+            return true;
+        }
+        ++segmentsScanned;
+        size_t n = seg.records.size();
+        for (size_t i = 0; i < n; ++i) {
+            const json& r = seg.records[desc ? n - 1 - i : i];
+            if (!pred.matches(r)) continue;
+            out.push_back(&r);
+            if (ordered && limit && out.size() >= limit) return false;
+        }
+        return true;
+    };
+
+    if (desc) {
+        for (auto it = segments.rbegin(); it != segments.rend() && visit(*it); ++it) {}
+    } else {
+        for (auto it = segments.begin(); it != segments.end() && visit(*it); ++it) {}
+    }
+
+    if (!ordered) {
+        std::stable_sort(out.begin(), out.end(), [&](const json* a, const json* b) {
+            return desc ? time_of(*a) > time_of(*b) : time_of(*a) < time_of(*b);
+        });
+        if (limit && out.size() > limit) out.resize(limit);
+    }
+    return out;
+}
+
+void TimeSeries::clear() {
+    segments.clear();
+    count = 0;
+    ordered = true;
+    lastTime = 0;
+}
+
+json TimeSeries::stats() const {
+    return {
+        {"type", "timeseries"},
+        {"records", count},
+        {"segments", segments.size()},
+        {"segmentSize", segmentSize},
+        {"ordered", ordered},
+        {"segmentsScanned", segmentsScanned},
+        {"segmentsPruned", segmentsPruned}
+    };
+}
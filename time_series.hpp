@@ -0,0 +1,58 @@
+#ifndef TIME_SERIES_HPP
+#define TIME_SERIES_HPP
+
+#include "json.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Append-only collection of records stamped by a numeric time field.
+// Records are grouped into fixed-size segments in arrival order, and each
+// segment keeps the min/max time it holds, so a time-range query skips
+// every segment that cannot overlap the range. Records are never updated
+// or deleted; on disk they are appended one line at a time (see Database).
+class TimeSeries {
+public:
+    static constexpr size_t kDefaultSegmentSize = 1024;
+
+    TimeSeries(std::string timeField, size_t segmentSize);
+
+    // Builds a series from its spec; throws std::invalid_argument.
+    static TimeSeries from_spec(const nlohmann::json& spec);
+    nlohmann::json spec() const;
+    const std::string& time_field() const { return timeField; }
+
+    // Checks that record is an object with a numeric time field.
+    bool valid_record(const nlohmann::json& record) const;
+    void append(nlohmann::json record);     // record must be valid
+
+    // Records matching filter in time order (newest first if desc), at
+    // most limit of them (0 = no limit). Bounds on the time field in the
+    // filter ($gt/$gte/$lt/$lte or equality) prune whole segments.
+    std::vector<const nlohmann::json*> scan(const nlohmann::json& filter, size_t limit, bool desc) const;
+
+    void clear();
+    size_t size() const { return count; }
+    nlohmann::json stats() const;
+
+private:
+    struct Segment {
+        double minTime;
+        double maxTime;
+        std::vector<nlohmann::json> records;
+    };
+
+    std::string timeField;
+    size_t segmentSize;
+    std::vector<Segment> segments;
+    size_t count = 0;
+    bool ordered = true;    // every append so far was at or after the last one
+    double lastTime = 0;
+
+    mutable uint64_t segmentsScanned = 0;
+    mutable uint64_t segmentsPruned = 0;
+
+    double time_of(const nlohmann::json& record) const;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "uring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static std::runtime_error sys_error(const char* what) {
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+Uring::Uring(unsigned entries) {
+    // Completions are only reaped by the thread that submits, inside
+    // io_uring_enter, so the kernel need not interrupt it to run them.
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        p = io_uring_params{};
+        p.flags = IORING_SETUP_CLAMP;
+        fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (fd < 0) throw sys_error("io_uring_setup");
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        ::close(fd);
+        throw std::runtime_error("io_uring_setup: kernel too old");
+    }
+    feats = p.features;
+
+    ringsSize = std::max<size_t>(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                                 p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    rings = ::mmap(nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        rings = nullptr;
+        ::close(fd);
+        throw sys_error("io_uring mmap");
+    }
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) {
+        ::munmap(rings, ringsSize);
+        ::close(fd);
+        throw sys_error("io_uring mmap");
+    }
+    sqes = static_cast<io_uring_sqe*>(s);
+
+    char* base = static_cast<char*>(rings);
+    sqHead = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+    sqEntries = p.sq_entries;
+    sqLocalTail = sqSubmitted = *sqTail;
+    cqHead = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+}
+
+// The ring goes first: closing it cancels whatever still points into the
+// buffers unmapped after it.
+Uring::~Uring() {
+    ::close(fd);
+    if (sqes) ::munmap(sqes, sqesSize);
+    if (rings) ::munmap(rings, ringsSize);
+    if (bufBase) ::munmap(bufBase, (size_t)bufCount * bufSize);
+}
+
+bool Uring::supports(uint8_t opcode) const {
+    constexpr unsigned kOps = 256;
+    std::vector<char> mem(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(mem.data());
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, kOps) < 0) return false;
+    return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+int Uring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    int n = (int)::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    if (n > 0) sqSubmitted += (unsigned)n;
+    return n;
+}
+
+io_uring_sqe& Uring::prepare(uint8_t opcode, int target, uint64_t userData) {
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries) {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        ++pendingCalls;
+        if (enter(sqLocalTail - sqSubmitted, 0, 0) < 0) throw sys_error("io_uring_enter");
+    }
+    unsigned idx = sqLocalTail & sqMask;
+    sqArray[idx] = idx;
+    ++sqLocalTail;
+    io_uring_sqe& sqe = sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = target;
+    sqe.user_data = userData;
+    return sqe;
+}
+
+unsigned Uring::submit_and_wait() {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned calls = pendingCalls + 1;
+    pendingCalls = 0;
+    if (enter(sqLocalTail - sqSubmitted, 1, IORING_ENTER_GETEVENTS) < 0) {
+        // EINTR: nothing submitted, the caller comes round again. EBUSY:
+        // completions are backed up in the kernel; reaping makes room.
+        if (errno != EINTR && errno != EBUSY && errno != EAGAIN) throw sys_error("io_uring_enter");
+    }
+    return calls;
+}
+
+unsigned Uring::submit() {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned calls = pendingCalls + 1;
+    pendingCalls = 0;
+    if (enter(sqLocalTail - sqSubmitted, 0, 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        throw sys_error("io_uring_enter");
+    return calls;
+}
+
+// Classic provided buffers rather than a registered buffer ring
+// (IORING_REGISTER_PBUF_RING): the ring registers on some kernels whose
+// receives then never find a buffer in it, and recycling here costs only
+// a queued entry, not a system call.
+void Uring::provide_buffers(uint16_t group, unsigned count, unsigned size) {
+    void* b = ::mmap(nullptr, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) throw sys_error("buffer mmap");
+    bufBase = static_cast<char*>(b);
+    bufSize = size;
+    bufCount = count;
+    bufGroup = group;
+
+    io_uring_sqe& sqe = prepare(IORING_OP_PROVIDE_BUFFERS, (int)count, 0);
+    sqe.addr = reinterpret_cast<uint64_t>(bufBase);
+    sqe.len = size;
+    sqe.off = 0;
+    sqe.buf_group = group;
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    ++pendingCalls;
+    if (enter(sqLocalTail - sqSubmitted, 1, IORING_ENTER_GETEVENTS) < 0) throw sys_error("io_uring_enter");
+    int res = -EAGAIN;
+    reap([&](const io_uring_cqe& cqe) { res = cqe.res; });
+    if (res < 0) {
+        errno = -res;
+        throw sys_error("IORING_OP_PROVIDE_BUFFERS");
+    }
+}
+
+void Uring::recycle(uint16_t id) {
+    io_uring_sqe& sqe = prepare(IORING_OP_PROVIDE_BUFFERS, 1, 0);
+    sqe.flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer(id));
+    sqe.len = bufSize;
+    sqe.off = id;
+    sqe.buf_group = bufGroup;
+}
@@ -0,0 +1,86 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// A minimal io_uring driver over the raw system calls (liburing is not a
+// dependency): one submission and one completion ring mapped from the
+// kernel, plus an optional group of provided buffers that receives pick
+// from with IOSQE_BUFFER_SELECT. Not thread-safe; one thread owns it.
+class Uring {
+public:
+    // Throws std::runtime_error if the kernel has no usable io_uring
+    // (too old, or disabled by sysctl or seccomp).
+    explicit Uring(unsigned entries);
+    ~Uring();
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // IORING_FEAT_* bits the kernel reported at setup.
+    unsigned features() const { return feats; }
+    // Whether the kernel implements opcode (IORING_REGISTER_PROBE). Says
+    // nothing about newer flags of that opcode, such as multishot.
+    bool supports(uint8_t opcode) const;
+
+    // A zeroed entry for opcode on fd, queued until the next submit.
+    io_uring_sqe& prepare(uint8_t opcode, int fd, uint64_t userData);
+    // Submits the queued entries and waits until a completion is ready.
+    // Both return the number of system calls made since the last submit.
+    unsigned submit_and_wait();
+    // Submits without waiting; sockets with room act on them straight away.
+    unsigned submit();
+
+    // Calls f(const io_uring_cqe&) for every ready completion, then
+    // hands their slots back to the kernel.
+    template <class F>
+    void reap(F&& f) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) f(cqes[head & cqMask]);
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Hands count buffers of size bytes to the kernel as buffer group
+    // `group`. Call once, before anything selects from it; throws if the
+    // kernel cannot provide buffers.
+    void provide_buffers(uint16_t group, unsigned count, unsigned size);
+    const char* buffer(uint16_t id) const { return bufBase + (size_t)id * bufSize; }
+    // Gives a buffer the kernel filled back to the group once its bytes
+    // are used; queued like prepare(), with no completion unless it fails
+    // (user_data 0).
+    void recycle(uint16_t id);
+
+private:
+    int fd = -1;
+    unsigned feats = 0;
+    void* rings = nullptr;
+    size_t ringsSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail = 0;   // entries prepared; the kernel sees them on submit
+    unsigned sqSubmitted = 0;
+    unsigned pendingCalls = 0;  // enter calls made by prepare() when the ring filled
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+
+    char* bufBase = nullptr;
+    unsigned bufSize = 0;
+    unsigned bufCount = 0;
+    uint16_t bufGroup = 0;
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+};
+
+#endif